@@ -0,0 +1,253 @@
+# Benchmark driver for photonmap
+#
+# Renders the benchmark scenes with pinned photon counts, seeds and
+# resolutions, prints throughput, peak memory and phase times, and compares
+# them with bench/baseline.json.  Every image is also compared with its
+# golden render in bench/golden, so speedups that change the picture fail.
+#
+# Run from the top-level directory (or with "make bench"):
+#   python3 bench/bench.py [-update] [-tolerance 0.25] [-rmse_tolerance 0.01] [-num_threads N]
+#
+# -update replaces the baseline and the golden renders with the results of
+# this run.  Throughputs may drop and peak memory may grow by at most
+# -tolerance (a fraction of the baseline value), and the RMSE of the linear
+# radiance divided by the mean golden radiance may be at most -rmse_tolerance.
+#
+# Throughput and memory depend on the machine, so the baseline also records
+# the host, processor and thread count it was measured with, and they are
+# only compared on the same machine with the same number of threads.  The
+# committed baseline numbers are not portable: run -update once on a new
+# machine before relying on the speed checks.  Images do not depend on the
+# machine and are always compared.
+
+import argparse
+import json
+import math
+import os
+import platform
+import struct
+import subprocess
+import sys
+import tempfile
+
+
+
+# Paths (relative to the top-level directory)
+
+EXE = 'src/photonmap'
+INPUT_DIR = 'input'
+BENCH_DIR = os.path.dirname(os.path.realpath(__file__))
+BASELINE_PATH = os.path.join(BENCH_DIR, 'baseline.json')
+GOLDEN_DIR = os.path.join(BENCH_DIR, 'golden')
+
+# Scenes and their pinned settings (a scene with a copy in BENCH_DIR is read from
+# there, so the bench can pin fixes without changing the shipped scene)
+
+SCENES = ['cornell', 'glass_spheres', 'caustic', 'beer', 'fourspheres']
+SETTINGS = {
+	'resolution': (128, 128),
+	'num_samples': 8,
+	'num_general_map': 100000,
+	'num_caustic_map': 100000,
+	'seed': 1,
+}
+
+PHASES = ['read_scene', 'emit_photons', 'trace_photons', 'build_kdtree',
+	'precompute_irradiance', 'render', 'tone_map', 'write_image']
+
+
+
+def read_pfm(path):
+	# returns width, height and flat list of floats of a color PFM file
+	with open(path, 'rb') as f:
+		tokens = []
+		while len(tokens) < 4:
+			line = f.readline()
+			if not line:
+				raise ValueError('truncated PFM header in ' + path)
+			tokens += line.split()
+		if tokens[0] != b'PF':
+			raise ValueError('not a color PFM file: ' + path)
+		w, h, scale = int(tokens[1]), int(tokens[2]), float(tokens[3])
+		data = f.read(12 * w * h)
+	if len(data) != 12 * w * h:
+		raise ValueError('truncated PFM data in ' + path)
+	endian = '<' if scale < 0 else '>'
+	return w, h, struct.unpack(endian + str(3 * w * h) + 'f', data)
+
+
+def relative_rmse(path, golden_path):
+	# returns RMSE of two PFM images divided by mean of the golden one
+	w, h, values = read_pfm(path)
+	gw, gh, golden = read_pfm(golden_path)
+	if (w, h) != (gw, gh):
+		raise ValueError('image is %dx%d but golden render is %dx%d' % (w, h, gw, gh))
+	mean = sum(golden) / len(golden)
+	if not math.isfinite(mean) or mean <= 0:
+		raise ValueError('golden render has mean %g, so it checks nothing' % mean)
+	sum_squared = sum((a - b) * (a - b) for a, b in zip(values, golden))
+	rmse = (sum_squared / len(golden)) ** 0.5
+	return rmse / mean if math.isfinite(rmse) else float('inf')
+
+
+def machine_description(num_threads):
+	# returns host, processor and thread count that throughput and memory depend on
+	processor = platform.processor() or platform.machine()
+	try:
+		with open('/proc/cpuinfo') as f:
+			for line in f:
+				if line.startswith('model name'):
+					processor = line.split(':', 1)[1].strip()
+					break
+	except IOError:
+		pass
+	return {
+		'host': platform.node(),
+		'processor': processor,
+		'num_threads': num_threads if num_threads > 0 else (os.cpu_count() or 1),
+	}
+
+
+def scene_path(scene):
+	# returns path of scene file, preferring the bench copy
+	path = os.path.join(BENCH_DIR, scene + '.scn')
+	if os.path.exists(path):
+		return path
+	return os.path.join(INPUT_DIR, scene + '.scn')
+
+
+def run_scene(scene, out_dir, num_threads):
+	# renders scene and returns its metrics
+	image_path = os.path.join(out_dir, scene + '.pfm')
+	stats_path = os.path.join(out_dir, scene + '.json')
+	command = [EXE, scene_path(scene), image_path,
+		'-resolution', str(SETTINGS['resolution'][0]), str(SETTINGS['resolution'][1]),
+		'-num_samples', str(SETTINGS['num_samples']),
+		'-num_general_map', str(SETTINGS['num_general_map']),
+		'-num_caustic_map', str(SETTINGS['num_caustic_map']),
+		'-seed', str(SETTINGS['seed']),
+		'-num_threads', str(num_threads),
+		'-stats', stats_path]
+	with open(os.devnull, 'w') as devnull:
+		process = subprocess.Popen(command, stdout=devnull)
+		_, status, usage = os.wait4(process.pid, 0)
+	process.returncode = status
+	if status != 0:
+		raise RuntimeError(' '.join(command) + ' failed')
+
+	with open(stats_path) as f:
+		stats = json.load(f)
+
+	# peak resident set size as measured by photonmap itself, since on Linux
+	# ru_maxrss of the child also counts this script's memory at fork time
+	rss_mb = stats.get('peak_rss_mb', 0)
+	if rss_mb <= 0:
+		rss_mb = usage.ru_maxrss / (1024.0 * 1024.0 if sys.platform == 'darwin' else 1024.0)
+	wall = dict((phase, stats['phases'][phase]['wall_seconds']) for phase in PHASES)
+	counters = stats['counters']
+	rays = counters['primary_rays'] + counters['shadow_rays'] + counters['specular_rays'] + counters['photon_rays']
+
+	def rate(count, seconds):
+		return count / seconds if seconds > 0 else 0.0
+
+	return {
+		'photons_per_second': rate(counters['photons_emitted'], wall['emit_photons'] + wall['trace_photons']),
+		'rays_per_second': rate(rays, wall['trace_photons'] + wall['render']),
+		'knn_queries_per_second': rate(counters['knn_queries'], wall['precompute_irradiance'] + wall['render']),
+		'peak_rss_mb': rss_mb,
+		'wall_seconds': wall,
+		'image': image_path,
+	}
+
+
+def check(name, value, baseline, tolerance, higher_is_better):
+	# returns failure message if value is worse than baseline by more than tolerance
+	if baseline is None or baseline <= 0:
+		return None
+	if higher_is_better and value < baseline * (1 - tolerance):
+		return '%s dropped from %.4g to %.4g' % (name, baseline, value)
+	if not higher_is_better and value > baseline * (1 + tolerance):
+		return '%s grew from %.4g to %.4g' % (name, baseline, value)
+	return None
+
+
+
+def main():
+	parser = argparse.ArgumentParser(description='Benchmark photonmap on the bundled scenes')
+	parser.add_argument('-update', action='store_true', help='replace baseline and golden renders')
+	parser.add_argument('-tolerance', type=float, default=0.25, help='allowed fraction of throughput loss or memory growth')
+	parser.add_argument('-rmse_tolerance', type=float, default=0.01, help='allowed RMSE relative to mean golden radiance')
+	parser.add_argument('-num_threads', type=int, default=0, help='render threads (0 means one per hardware thread)')
+	args = parser.parse_args()
+
+	machine = machine_description(args.num_threads)
+	baseline = None
+	compare_speed = False
+	if not args.update:
+		if not os.path.exists(BASELINE_PATH):
+			sys.exit('no baseline in %s, run with -update first' % BASELINE_PATH)
+		with open(BASELINE_PATH) as f:
+			baseline = json.load(f)
+		if baseline.get('settings') != json.loads(json.dumps(SETTINGS)):
+			sys.exit('baseline was recorded with other settings, run with -update')
+		compare_speed = (baseline.get('machine') == machine)
+		if not compare_speed:
+			print('baseline was measured on %s, not on this machine (%s), so only images are compared' %
+				(json.dumps(baseline.get('machine')), json.dumps(machine)))
+
+	out_dir = tempfile.mkdtemp(prefix='photonmap_bench_')
+	results = {}
+	failures = []
+	print('%-14s %12s %12s %12s %9s %9s %9s %9s %9s' % ('scene', 'photons/s', 'rays/s', 'knn/s',
+		'rss(MB)', 'trace(s)', 'build(s)', 'render(s)', 'rmse'))
+	for scene in SCENES:
+		metrics = run_scene(scene, out_dir, args.num_threads)
+		golden_path = os.path.join(GOLDEN_DIR, scene + '.pfm')
+		rmse = 0.0
+		if args.update:
+			if not os.path.isdir(GOLDEN_DIR):
+				os.makedirs(GOLDEN_DIR)
+			os.replace(metrics['image'], golden_path)
+		elif os.path.exists(golden_path):
+			try:
+				rmse = relative_rmse(metrics['image'], golden_path)
+				if rmse > args.rmse_tolerance:
+					failures.append('%s: image differs from golden render (relative rmse %.4g)' % (scene, rmse))
+			except ValueError as error:
+				rmse = float('nan')
+				failures.append('%s: %s' % (scene, error))
+		else:
+			failures.append('%s: no golden render %s' % (scene, golden_path))
+		del metrics['image']
+		results[scene] = metrics
+
+		wall = metrics['wall_seconds']
+		print('%-14s %12.0f %12.0f %12.0f %9.1f %9.3f %9.3f %9.3f %9.2g' % (scene,
+			metrics['photons_per_second'], metrics['rays_per_second'], metrics['knn_queries_per_second'],
+			metrics['peak_rss_mb'], wall['emit_photons'] + wall['trace_photons'], wall['build_kdtree'],
+			wall['render'], rmse))
+		sys.stdout.flush()
+
+		if compare_speed:
+			base = baseline['scenes'].get(scene, {})
+			for name in ['photons_per_second', 'rays_per_second', 'knn_queries_per_second']:
+				failure = check(name, metrics[name], base.get(name), args.tolerance, True)
+				if failure: failures.append(scene + ': ' + failure)
+			failure = check('peak_rss_mb', metrics['peak_rss_mb'], base.get('peak_rss_mb'), args.tolerance, False)
+			if failure: failures.append(scene + ': ' + failure)
+
+	if args.update:
+		with open(BASELINE_PATH, 'w') as f:
+			json.dump({'settings': SETTINGS, 'machine': machine, 'scenes': results}, f, indent=2, sort_keys=True)
+			f.write('\n')
+		print('updated %s and golden renders in %s' % (BASELINE_PATH, GOLDEN_DIR))
+		return 0
+
+	for failure in failures:
+		print('FAIL ' + failure)
+	print('%d failures' % len(failures) if failures else 'all scenes within tolerance of baseline')
+	return 1 if failures else 0
+
+
+if __name__ == '__main__':
+	sys.exit(main())
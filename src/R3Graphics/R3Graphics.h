@@ -10,6 +10,7 @@
 class R3Scene;
 class R3SceneNode;
 class R3SceneElement;
+class R3SceneBVH;
 
 
 
@@ -50,6 +51,7 @@ class R3SceneElement;
 
 #include "R3Graphics/R3SceneElement.h"
 #include "R3Graphics/R3SceneNode.h"
+#include "R3Graphics/R3SceneBVH.h"
 #include "R3Graphics/R3Scene.h"
 
 
@@ -105,21 +105,16 @@ Intersects(const R3Ray& ray,
   // Check bounding box
   if (!R3Intersects(ray, BBox())) return FALSE;
 
-  // Check each triangle for intersection
+  // Check each triangle for intersection with watertight test
   RNScalar min_t = FLT_MAX;
+  R3TriangleRay triangle_ray(ray);
   for (int i = 0; i < NTriangles(); i++) {
     const R3Triangle *triangle = Triangle(i);
-    R3Point point;
-    R3Vector normal;
-    RNScalar t;
-    if (R3Intersects(ray, *triangle, &point, &normal, &t) == R3_POINT_CLASS_ID) {
-      if (t < min_t) {
-        if (hit_point) *hit_point = point;
-        if (hit_normal) *hit_normal = normal;
-        if (hit_triangle_index) *hit_triangle_index = i;
-        if (hit_t) *hit_t = t;
-        min_t = t;
-      }
+    if (triangle_ray.Intersects(triangle->V0()->Position(), triangle->V1()->Position(), triangle->V2()->Position(), min_t, &min_t)) {
+      if (hit_point) *hit_point = ray.Point(min_t);
+      if (hit_normal) *hit_normal = triangle->Normal();
+      if (hit_triangle_index) *hit_triangle_index = i;
+      if (hit_t) *hit_t = min_t;
     }
   }
 
@@ -34,7 +34,8 @@ R3Scene(void)
     brdfs(),
     textures(),
     ambient(0, 0, 0),
-    background(0, 0, 0)
+    background(0, 0, 0),
+    bvh(NULL)
 {
   // Create root node
   root = new R3SceneNode(this);
@@ -49,6 +50,9 @@ R3Scene(void)
 R3Scene::
 ~R3Scene(void)
 {
+  // Delete bounding volume hierarchy
+  DeleteBVH();
+
   // Delete everything
   // ???
 }
@@ -474,12 +478,55 @@ Intersects(const R3Ray& ray,
   R3Point *hit_point, R3Vector *hit_normal, RNScalar *hit_t,
   RNScalar min_t, RNScalar max_t) const
 {
+  // Intersect with bounding volume hierarchy if there is one
+  if (bvh) return bvh->Intersects(ray, hit_node, hit_element, hit_shape, hit_point, hit_normal, hit_t, min_t, max_t);
+
   // Intersect with root node
   return root->Intersects(ray, hit_node, hit_element, hit_shape, hit_point, hit_normal, hit_t, min_t, max_t);
 }
 
 
 
+RNBoolean R3Scene::
+Occluded(const R3Point& from, const R3Point& to) const
+{
+  // Get segment between points, excluding surfaces within epsilon of either end
+  R3Vector vector = to - from;
+  RNLength length = vector.Length();
+  if (length <= 2 * RN_EPSILON) return FALSE;
+  vector /= length;
+  R3Ray ray(from + RN_EPSILON * vector, vector, TRUE);
+  RNScalar max_t = length - 2 * RN_EPSILON;
+
+  // Check for any hit with bounding volume hierarchy if there is one
+  if (bvh) return bvh->Occluded(ray, max_t);
+
+  // Check for any hit with root node
+  return root->Occluded(ray, max_t);
+}
+
+
+
+void R3Scene::
+BuildBVH(void)
+{
+  // Build bounding volume hierarchy over all shapes in world coordinates
+  DeleteBVH();
+  bvh = new R3SceneBVH(this);
+}
+
+
+
+void R3Scene::
+DeleteBVH(void)
+{
+  // Delete bounding volume hierarchy
+  if (bvh) delete bvh;
+  bvh = NULL;
+}
+
+
+
 void R3Scene::
 Draw(const R3DrawFlags draw_flags, RNBoolean set_camera, RNBoolean set_lights) const
 {
@@ -582,6 +629,9 @@ ReadFile(const char *filename)
     InsertLight(light2);
   }
 
+  // Build bounding volume hierarchy for ray intersections
+  BuildBVH();
+
   // Return success
   return 1;
 }
@@ -1389,8 +1439,12 @@ ReadMesh(const char *filename)
     triangles.Insert(triangle);
   }
 
+  // Create triangle array with bounding volume hierarchy for ray intersections
+  R3TriangleArray *array = new R3TriangleArray(vertices, triangles);
+  array->BuildBVH();
+
   // Return triangle array
-  return new R3TriangleArray(vertices, triangles);
+  return array;
 }
 
  
@@ -64,6 +64,11 @@ public:
   void RemoveTransformations(void);
   void SubdivideTriangles(RNLength max_edge_length);
 
+  // Acceleration functions (hierarchy is deleted when nodes change)
+  const R3SceneBVH *BVH(void) const;
+  void BuildBVH(void);
+  void DeleteBVH(void);
+
   // Query functions
   RNLength Distance(const R3Point& point) const;
   RNBoolean FindClosest(const R3Point& point,
@@ -74,6 +79,7 @@ public:
     R3SceneNode **hit_node = NULL, R3SceneElement **hit_element = NULL, R3Shape **hit_shape = NULL,
     R3Point *hit_point = NULL, R3Vector *hit_normal = NULL, RNScalar *hit_t = NULL,
     RNScalar min_t = 0.0, RNScalar max_t = RN_INFINITY) const;
+  RNBoolean Occluded(const R3Point& from, const R3Point& to) const;
 
   // I/O functions
   int ReadFile(const char *filename);
@@ -106,6 +112,7 @@ private:
   R3Viewer viewer;
   RNRgb ambient;
   RNRgb background;
+  R3SceneBVH *bvh;
 };
 
 
@@ -145,6 +152,15 @@ Root(void) const
 
 
 
+inline const R3SceneBVH *R3Scene::
+BVH(void) const
+{
+  // Return bounding volume hierarchy (NULL if not built)
+  return bvh;
+}
+
+
+
 inline int R3Scene::
 NNodes(void) const
 {
@@ -0,0 +1,486 @@
+/* Source file for the R3 scene bounding volume hierarchy class */
+
+
+
+/* Include files */
+
+#include "R3Graphics.h"
+
+
+
+/* Private constants */
+
+// Number of centroid bins evaluated per split
+static const int R3scene_bvh_nbins = 16;
+
+// Cost of traversing a node relative to intersecting a shape
+static const RNScalar R3scene_bvh_traversal_cost = 0.125;
+
+// Deepest tree that fits on the traversal stack
+static const int R3scene_bvh_max_depth = 60;
+
+
+
+/* Node definitions */
+
+struct R3SceneBVHNode {
+  // Bounding box (lo/hi, xyz)
+  RNCoord box[2][3];
+
+  // First primitive (leaf) or index of second child (interior)
+  int index;
+
+  // Number of primitives (zero for interior nodes)
+  int nprimitives;
+};
+
+struct R3SceneBVHPrimitive {
+  // Shape and where it is in the scene
+  R3Shape *shape;
+  R3SceneElement *element;
+  R3SceneNode *node;
+
+  // Index of world and inverse matrices (-1 if shape is in world coordinates)
+  int matrix_index;
+};
+
+
+
+/* Member functions */
+
+static void
+CountPrimitives(R3SceneNode *node, const R3Affine& parent_transformation, int& nprimitives, int& nmatrices)
+{
+  // Compute accumulated transformation
+  R3Affine transformation(parent_transformation);
+  transformation.Transform(node->Transformation());
+
+  // Count shapes and transformed nodes with shapes
+  int nshapes = 0;
+  for (int i = 0; i < node->NElements(); i++) {
+    nshapes += node->Element(i)->NShapes();
+  }
+  nprimitives += nshapes;
+  if ((nshapes > 0) && !transformation.IsIdentity()) nmatrices += 2;
+
+  // Count children
+  for (int i = 0; i < node->NChildren(); i++) {
+    CountPrimitives(node->Child(i), transformation, nprimitives, nmatrices);
+  }
+}
+
+
+
+R3SceneBVH::
+R3SceneBVH(R3Scene *scene)
+  : primitives(NULL),
+    nprimitives(0),
+    matrices(NULL),
+    nmatrices(0),
+    nodes(NULL),
+    nnodes(0),
+    bbox(R3null_box)
+{
+  // Count shapes
+  int max_primitives = 0;
+  int max_matrices = 0;
+  CountPrimitives(scene->Root(), R3identity_affine, max_primitives, max_matrices);
+  if (max_primitives == 0) return;
+
+  // Collect shapes with world-space bounding boxes
+  primitives = new R3SceneBVHPrimitive [ max_primitives ];
+  if (max_matrices > 0) matrices = new R4Matrix [ max_matrices ];
+  R3Box *primitive_boxes = new R3Box [ max_primitives ];
+  InsertPrimitives(scene->Root(), R3identity_affine, primitive_boxes);
+  assert(nprimitives == max_primitives);
+  assert(nmatrices == max_matrices);
+
+  // Compute centroids
+  R3Point *centroids = new R3Point [ nprimitives ];
+  for (int i = 0; i < nprimitives; i++) {
+    centroids[i] = primitive_boxes[i].Centroid();
+    bbox.Union(primitive_boxes[i]);
+  }
+
+  // Build tree (a binary tree has at most 2n-1 nodes)
+  nodes = new R3SceneBVHNode [ 2 * nprimitives - 1 ];
+  Build(0, nprimitives, primitive_boxes, centroids, 0);
+
+  // Delete temporary data
+  delete [] primitive_boxes;
+  delete [] centroids;
+}
+
+
+
+R3SceneBVH::
+~R3SceneBVH(void)
+{
+  // Delete arrays
+  if (nodes) delete [] nodes;
+  if (matrices) delete [] matrices;
+  if (primitives) delete [] primitives;
+}
+
+
+
+void R3SceneBVH::
+InsertPrimitives(R3SceneNode *node, const R3Affine& parent_transformation, R3Box *primitive_boxes)
+{
+  // Compute accumulated transformation
+  R3Affine transformation(parent_transformation);
+  transformation.Transform(node->Transformation());
+
+  // Store matrices of transformed nodes with shapes
+  int matrix_index = -1;
+  if (!transformation.IsIdentity()) {
+    int nshapes = 0;
+    for (int i = 0; i < node->NElements(); i++) {
+      nshapes += node->Element(i)->NShapes();
+    }
+    if (nshapes > 0) {
+      matrix_index = nmatrices;
+      matrices[nmatrices++] = transformation.Matrix();
+      matrices[nmatrices++] = transformation.InverseMatrix();
+    }
+  }
+
+  // Insert shapes of elements
+  for (int i = 0; i < node->NElements(); i++) {
+    R3SceneElement *element = node->Element(i);
+    for (int j = 0; j < element->NShapes(); j++) {
+      R3Shape *shape = element->Shape(j);
+      R3SceneBVHPrimitive& primitive = primitives[nprimitives];
+      primitive.shape = shape;
+      primitive.element = element;
+      primitive.node = node;
+      primitive.matrix_index = matrix_index;
+      R3Box box = shape->BBox();
+      if (matrix_index >= 0) box.Transform(transformation);
+      primitive_boxes[nprimitives++] = box;
+    }
+  }
+
+  // Insert shapes of children
+  for (int i = 0; i < node->NChildren(); i++) {
+    InsertPrimitives(node->Child(i), transformation, primitive_boxes);
+  }
+}
+
+
+
+static RNArea
+HalfArea(const R3Box& box)
+{
+  // Return half the surface area of box (empty boxes have none)
+  if (box.IsEmpty()) return 0;
+  RNLength dx = box.XLength();
+  RNLength dy = box.YLength();
+  RNLength dz = box.ZLength();
+  return dx*dy + dx*dz + dy*dz;
+}
+
+
+
+int R3SceneBVH::
+Build(int first, int n, R3Box *primitive_boxes, R3Point *centroids, int depth)
+{
+  // Allocate node
+  int index = nnodes++;
+  R3SceneBVHNode *node = &nodes[index];
+
+  // Compute bounding box of primitives and of their centroids
+  R3Box node_box = R3null_box;
+  R3Box centroid_box = R3null_box;
+  for (int i = first; i < first + n; i++) {
+    node_box.Union(primitive_boxes[i]);
+    centroid_box.Union(centroids[i]);
+  }
+
+  // Store box padded by tolerance of shape intersection tests
+  for (int dim = RN_X; dim <= RN_Z; dim++) {
+    node->box[RN_LO][dim] = node_box[RN_LO][dim] - RN_EPSILON;
+    node->box[RN_HI][dim] = node_box[RN_HI][dim] + RN_EPSILON;
+  }
+
+  // Find best binned split along longest axis of centroids
+  RNDimension dim = centroid_box.LongestAxis();
+  RNCoord min_coord = centroid_box[RN_LO][dim];
+  RNLength extent = centroid_box[RN_HI][dim] - min_coord;
+  int best_split = -1;
+  RNScalar best_cost = n;
+  if ((n > 1) && (extent > 0) && (depth < R3scene_bvh_max_depth)) {
+    // Sort centroids into bins
+    R3Box bin_boxes[R3scene_bvh_nbins];
+    int bin_counts[R3scene_bvh_nbins];
+    for (int b = 0; b < R3scene_bvh_nbins; b++) {
+      bin_boxes[b] = R3null_box;
+      bin_counts[b] = 0;
+    }
+    RNScalar bin_scale = R3scene_bvh_nbins / extent;
+    for (int i = first; i < first + n; i++) {
+      int b = (int) ((centroids[i][dim] - min_coord) * bin_scale);
+      if (b >= R3scene_bvh_nbins) b = R3scene_bvh_nbins - 1;
+      bin_boxes[b].Union(primitive_boxes[i]);
+      bin_counts[b]++;
+    }
+
+    // Sweep from the right to get area and count of right sides
+    RNArea right_areas[R3scene_bvh_nbins];
+    int right_counts[R3scene_bvh_nbins];
+    R3Box right_box = R3null_box;
+    int right_count = 0;
+    for (int b = R3scene_bvh_nbins - 1; b > 0; b--) {
+      right_box.Union(bin_boxes[b]);
+      right_count += bin_counts[b];
+      right_areas[b] = HalfArea(right_box);
+      right_counts[b] = right_count;
+    }
+
+    // Sweep from the left and evaluate surface area heuristic
+    RNArea node_area = HalfArea(node_box);
+    R3Box left_box = R3null_box;
+    int left_count = 0;
+    for (int b = 0; b < R3scene_bvh_nbins - 1; b++) {
+      left_box.Union(bin_boxes[b]);
+      left_count += bin_counts[b];
+      if ((left_count == 0) || (right_counts[b+1] == 0)) continue;
+      RNScalar cost = R3scene_bvh_traversal_cost;
+      if (node_area > 0) cost += (HalfArea(left_box) * left_count + right_areas[b+1] * right_counts[b+1]) / node_area;
+      else cost += n;
+      if ((best_split < 0) || (cost < best_cost)) {
+        best_split = b;
+        best_cost = cost;
+      }
+    }
+
+    // Keep small leaves when splitting does not pay off
+    if ((n <= max_leaf_primitives) && (best_cost >= n)) best_split = -1;
+  }
+
+  // Create leaf
+  if (best_split < 0) {
+    node->index = first;
+    node->nprimitives = n;
+    return index;
+  }
+
+  // Partition primitives on split bin
+  int i = first;
+  int j = first + n - 1;
+  RNScalar bin_scale = R3scene_bvh_nbins / extent;
+  while (i <= j) {
+    int b = (int) ((centroids[i][dim] - min_coord) * bin_scale);
+    if (b >= R3scene_bvh_nbins) b = R3scene_bvh_nbins - 1;
+    if (b <= best_split) { i++; continue; }
+    R3SceneBVHPrimitive swap_primitive = primitives[i]; primitives[i] = primitives[j]; primitives[j] = swap_primitive;
+    R3Box swap_box = primitive_boxes[i]; primitive_boxes[i] = primitive_boxes[j]; primitive_boxes[j] = swap_box;
+    R3Point swap_centroid = centroids[i]; centroids[i] = centroids[j]; centroids[j] = swap_centroid;
+    j--;
+  }
+  int nleft = i - first;
+  assert((nleft > 0) && (nleft < n));
+
+  // Build children (first child directly follows node)
+  node->nprimitives = 0;
+  Build(first, nleft, primitive_boxes, centroids, depth + 1);
+  int second = Build(first + nleft, n - nleft, primitive_boxes, centroids, depth + 1);
+  nodes[index].index = second;
+
+  // Return node index
+  return index;
+}
+
+
+
+static inline RNBoolean
+IntersectsNode(const R3SceneBVHNode& node, const RNCoord origin[3], const RNScalar inverse[3],
+  const int sign[3], RNScalar max_t, RNScalar& entry_t)
+{
+  // Intersect ray with slabs of node box
+  RNScalar tmin = (node.box[sign[0]][0] - origin[0]) * inverse[0];
+  RNScalar tmax = (node.box[1-sign[0]][0] - origin[0]) * inverse[0];
+  RNScalar t0 = (node.box[sign[1]][1] - origin[1]) * inverse[1];
+  RNScalar t1 = (node.box[1-sign[1]][1] - origin[1]) * inverse[1];
+  if (t0 > tmin) tmin = t0;
+  if (t1 < tmax) tmax = t1;
+  t0 = (node.box[sign[2]][2] - origin[2]) * inverse[2];
+  t1 = (node.box[1-sign[2]][2] - origin[2]) * inverse[2];
+  if (t0 > tmin) tmin = t0;
+  if (t1 < tmax) tmax = t1;
+
+  // Check whether interval overlaps [0, max_t]
+  if (tmin < 0) tmin = 0;
+  if (tmax < tmin) return FALSE;
+  if (tmin > max_t) return FALSE;
+  entry_t = tmin;
+  return TRUE;
+}
+
+
+
+RNBoolean R3SceneBVH::
+Intersects(const R3Ray& ray,
+  R3SceneNode **hit_node, R3SceneElement **hit_element, R3Shape **hit_shape,
+  R3Point *hit_point, R3Vector *hit_normal, RNScalar *hit_t,
+  RNScalar min_t, RNScalar max_t) const
+{
+  // Check tree
+  if (nnodes == 0) return FALSE;
+
+  // Precompute ray data for slab tests (zero components never cross a slab)
+  RNCoord origin[3];
+  RNScalar inverse[3];
+  int sign[3];
+  for (int dim = RN_X; dim <= RN_Z; dim++) {
+    origin[dim] = ray.Start()[dim];
+    RNScalar d = ray.Vector()[dim];
+    inverse[dim] = (d != 0) ? 1.0 / d : 1.0E30;
+    sign[dim] = (inverse[dim] < 0) ? 1 : 0;
+  }
+
+  // Check root
+  RNScalar closest_t = max_t;
+  RNScalar entry_t;
+  if (!IntersectsNode(nodes[0], origin, inverse, sign, closest_t, entry_t)) return FALSE;
+
+  // Traverse nodes front-to-back
+  const R3SceneBVHPrimitive *closest_primitive = NULL;
+  struct { int index; RNScalar t; } stack[R3scene_bvh_max_depth + 4];
+  int nstack = 0;
+  stack[nstack].index = 0;
+  stack[nstack].t = entry_t;
+  nstack++;
+  while (nstack > 0) {
+    // Pop node, skipping it if it starts beyond closest hit
+    nstack--;
+    if (stack[nstack].t > closest_t) continue;
+    const R3SceneBVHNode& node = nodes[stack[nstack].index];
+
+    // Check shapes in leaf
+    if (node.nprimitives > 0) {
+      for (int i = node.index; i < node.index + node.nprimitives; i++) {
+        const R3SceneBVHPrimitive& primitive = primitives[i];
+        R3Point point;
+        R3Vector normal;
+        RNScalar t;
+        if (primitive.matrix_index < 0) {
+          // Intersect shape in world coordinates
+          if (!primitive.shape->Intersects(ray, &point, &normal, &t)) continue;
+        }
+        else {
+          // Intersect shape with ray in its local coordinates
+          const R4Matrix& matrix = matrices[primitive.matrix_index];
+          const R4Matrix& inverse_matrix = matrices[primitive.matrix_index + 1];
+          R3Ray local_ray(inverse_matrix * ray.Start(), inverse_matrix * ray.Vector());
+          if (!primitive.shape->Intersects(local_ray, &point, &normal, &t)) continue;
+
+          // Transform hit back into world coordinates
+          point = matrix * point;
+          normal = matrix * normal;
+          normal.Normalize();
+          t = ray.Vector().Dot(point - ray.Start());
+        }
+
+        // Remember closest hit
+        if ((t >= min_t) && (t <= closest_t)) {
+          if (hit_point) *hit_point = point;
+          if (hit_normal) *hit_normal = normal;
+          closest_primitive = &primitive;
+          closest_t = t;
+        }
+      }
+      continue;
+    }
+
+    // Push children so that the nearer one is visited first
+    int child0 = stack[nstack].index + 1;
+    int child1 = node.index;
+    RNScalar t0, t1;
+    RNBoolean hit0 = IntersectsNode(nodes[child0], origin, inverse, sign, closest_t, t0);
+    RNBoolean hit1 = IntersectsNode(nodes[child1], origin, inverse, sign, closest_t, t1);
+    if (hit0 && hit1) {
+      if (t1 < t0) {
+        stack[nstack].index = child0; stack[nstack].t = t0; nstack++;
+        stack[nstack].index = child1; stack[nstack].t = t1; nstack++;
+      }
+      else {
+        stack[nstack].index = child1; stack[nstack].t = t1; nstack++;
+        stack[nstack].index = child0; stack[nstack].t = t0; nstack++;
+      }
+    }
+    else if (hit0) {
+      stack[nstack].index = child0; stack[nstack].t = t0; nstack++;
+    }
+    else if (hit1) {
+      stack[nstack].index = child1; stack[nstack].t = t1; nstack++;
+    }
+  }
+
+  // Check if found hit
+  if (!closest_primitive) return FALSE;
+
+  // Return closest hit
+  if (hit_node) *hit_node = closest_primitive->node;
+  if (hit_element) *hit_element = closest_primitive->element;
+  if (hit_shape) *hit_shape = closest_primitive->shape;
+  if (hit_t) *hit_t = closest_t;
+  return TRUE;
+}
+
+
+
+RNBoolean R3SceneBVH::
+Occluded(const R3Ray& ray, RNScalar max_t) const
+{
+  // Check tree
+  if (nnodes == 0) return FALSE;
+
+  // Precompute ray data for slab tests
+  RNCoord origin[3];
+  RNScalar inverse[3];
+  int sign[3];
+  for (int dim = RN_X; dim <= RN_Z; dim++) {
+    origin[dim] = ray.Start()[dim];
+    RNScalar d = ray.Vector()[dim];
+    inverse[dim] = (d != 0) ? 1.0 / d : 1.0E30;
+    sign[dim] = (inverse[dim] < 0) ? 1 : 0;
+  }
+
+  // Traverse nodes until first hit (order does not matter)
+  int stack[R3scene_bvh_max_depth + 4];
+  int nstack = 0;
+  stack[nstack++] = 0;
+  while (nstack > 0) {
+    int index = stack[--nstack];
+    const R3SceneBVHNode& node = nodes[index];
+    RNScalar entry_t;
+    if (!IntersectsNode(node, origin, inverse, sign, max_t, entry_t)) continue;
+
+    // Check shapes in leaf
+    if (node.nprimitives > 0) {
+      for (int i = node.index; i < node.index + node.nprimitives; i++) {
+        const R3SceneBVHPrimitive& primitive = primitives[i];
+        if (primitive.matrix_index < 0) {
+          // Check shape in world coordinates
+          if (R3Occluded(ray, *(primitive.shape), max_t)) return TRUE;
+        }
+        else {
+          // Check shape with ray and segment end in its local coordinates
+          const R4Matrix& inverse_matrix = matrices[primitive.matrix_index + 1];
+          R3Vector local_vector = inverse_matrix * ray.Vector();
+          R3Ray local_ray(inverse_matrix * ray.Start(), local_vector);
+          if (R3Occluded(local_ray, *(primitive.shape), max_t * local_vector.Length())) return TRUE;
+        }
+      }
+      continue;
+    }
+
+    // Push children
+    stack[nstack++] = node.index;
+    stack[nstack++] = index + 1;
+  }
+
+  // No shape hit
+  return FALSE;
+}
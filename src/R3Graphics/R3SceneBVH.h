@@ -0,0 +1,83 @@
+/* Include file for the R3 scene bounding volume hierarchy class */
+
+
+
+/* Node declarations */
+
+struct R3SceneBVHNode;
+struct R3SceneBVHPrimitive;
+
+
+
+/* Class definition */
+
+// Every shape of a scene is collected with its element, node, and the
+// accumulated transformation of its node path into one flat hierarchy of
+// world-space bounding boxes (built with the surface area heuristic).  Rays are
+// traversed front-to-back with a stack, and only shapes under a transformation
+// are intersected in local coordinates, using matrices precomputed at build.
+
+class R3SceneBVH {
+public:
+  // Constructor functions
+  R3SceneBVH(R3Scene *scene);
+  ~R3SceneBVH(void);
+
+  // Property functions
+  const R3Box& BBox(void) const;
+  int NNodes(void) const;
+  int NPrimitives(void) const;
+
+  // Query functions
+  RNBoolean Intersects(const R3Ray& ray,
+    R3SceneNode **hit_node = NULL, R3SceneElement **hit_element = NULL, R3Shape **hit_shape = NULL,
+    R3Point *hit_point = NULL, R3Vector *hit_normal = NULL, RNScalar *hit_t = NULL,
+    RNScalar min_t = 0.0, RNScalar max_t = RN_INFINITY) const;
+  RNBoolean Occluded(const R3Ray& ray, RNScalar max_t) const;
+
+public:
+  // Internal build functions
+  void InsertPrimitives(R3SceneNode *node, const R3Affine& parent_transformation, R3Box *primitive_boxes);
+  int Build(int first, int nprimitives, R3Box *primitive_boxes, R3Point *centroids, int depth);
+
+  // Maximum number of shapes in a leaf
+  static const int max_leaf_primitives = 2;
+
+private:
+  R3SceneBVHPrimitive *primitives;
+  int nprimitives;
+  R4Matrix *matrices;
+  int nmatrices;
+  R3SceneBVHNode *nodes;
+  int nnodes;
+  R3Box bbox;
+};
+
+
+
+/* Inline functions */
+
+inline const R3Box& R3SceneBVH::
+BBox(void) const
+{
+  // Return bounding box
+  return bbox;
+}
+
+
+
+inline int R3SceneBVH::
+NNodes(void) const
+{
+  // Return number of nodes
+  return nnodes;
+}
+
+
+
+inline int R3SceneBVH::
+NPrimitives(void) const
+{
+  // Return number of shapes
+  return nprimitives;
+}
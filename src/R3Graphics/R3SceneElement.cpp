@@ -244,6 +244,27 @@ Intersects(const R3Ray& ray, R3Shape **hit_shape,
 
 
 
+RNBoolean R3SceneElement::
+Occluded(const R3Ray& ray, RNScalar max_t) const
+{
+  // Check if ray intersects bounding box
+  RNScalar bbox_t;
+  if (!R3Contains(BBox(), ray.Start())) {
+    if (!R3Intersects(ray, BBox(), NULL, NULL, &bbox_t)) return FALSE;
+    if (RNIsGreater(bbox_t, max_t)) return FALSE;
+  }
+
+  // Stop at first shape hit with 0 <= t < max_t
+  for (int i = 0; i < NShapes(); i++) {
+    if (R3Occluded(ray, *Shape(i), max_t)) return TRUE;
+  }
+
+  // No shape hit
+  return FALSE;
+}
+
+
+
 void R3SceneElement::
 Draw(const R3DrawFlags draw_flags) const
 {
@@ -511,6 +511,42 @@ Intersects(const R3Ray& ray,
 
 
 
+RNBoolean R3SceneNode::
+Occluded(const R3Ray& ray, RNScalar max_t) const
+{
+  // Check if ray intersects bounding box
+  RNScalar bbox_t;
+  if (!R3Contains(BBox(), ray.Start())) {
+    if (!R3Intersects(ray, BBox(), NULL, NULL, &bbox_t)) return FALSE;
+    if (RNIsGreater(bbox_t, max_t)) return FALSE;
+  }
+
+  // Apply inverse transformation to ray and to segment end
+  R3Ray node_ray = ray;
+  RNScalar node_max_t = max_t;
+  if (!transformation.IsIdentity()) {
+    node_ray.InverseTransform(transformation);
+    R3Vector v = max_t * ray.Vector();
+    transformation.ApplyInverse(v);
+    node_max_t = v.Length();
+  }
+
+  // Check elements
+  for (int i = 0; i < elements.NEntries(); i++) {
+    if (elements.Kth(i)->Occluded(node_ray, node_max_t)) return TRUE;
+  }
+
+  // Check children
+  for (int i = 0; i < children.NEntries(); i++) {
+    if (children.Kth(i)->Occluded(node_ray, node_max_t)) return TRUE;
+  }
+
+  // No hit
+  return FALSE;
+}
+
+
+
 void R3SceneNode::
 Draw(const R3DrawFlags draw_flags) const
 {
@@ -569,6 +605,9 @@ InvalidateBBox(void)
 
   // Invalidate parent's bounding box
   if (parent) parent->InvalidateBBox();
+
+  // Invalidate scene's bounding volume hierarchy
+  else if (scene) scene->DeleteBVH();
 }
 
 
@@ -359,24 +359,32 @@ WalkCamera(RNScalar pitch_factor, RNScalar yaw_factor, RNScalar roll_factor, RNS
 const R3Ray R3Viewer::
 WorldRay(int x, int y) const
 {   
+    // Return ray through random point of pixel
     RNScalar anti_alias_x = RNRandomScalar() -0.5;
     RNScalar anti_alias_y = RNRandomScalar() -0.5;
+    return WorldRay(x + anti_alias_x, y + anti_alias_y);
+}
+
+
 
+const R3Ray R3Viewer::
+WorldRay(RNScalar x, RNScalar y) const
+{   
     // if (true){
     // return R3Ray(camera.Origin(), R3Point(1,1,1));
     // }
     // Return ray from camera origin to appropriate point on far plane
 #if FALSE
     // This also works
-    RNScalar dx = (RNScalar) (2 * (anti_alias_x + x - viewport.XCenter())) / (RNScalar) viewport.Width();
-    RNScalar dy = (RNScalar) (2 * (anti_alias_y + y - viewport.YCenter())) / (RNScalar) viewport.Height();
+    RNScalar dx = (RNScalar) (2 * (x - viewport.XCenter())) / (RNScalar) viewport.Width();
+    RNScalar dy = (RNScalar) (2 * (y - viewport.YCenter())) / (RNScalar) viewport.Height();
     R3Vector v = camera.Towards();
     v.Rotate(camera.Up(), dx * camera.XFOV());
     v.Rotate(camera.Left(), dy * camera.YFOV());
     return R3Ray(camera.Origin(), v);
 #else
-    RNScalar dx = (RNScalar) (2 * (anti_alias_x + x - viewport.XCenter())) / (RNScalar) viewport.Width();
-    RNScalar dy = (RNScalar) (2 * (anti_alias_y + y - viewport.YCenter())) / (RNScalar) viewport.Height();
+    RNScalar dx = (RNScalar) (2 * (x - viewport.XCenter())) / (RNScalar) viewport.Width();
+    RNScalar dy = (RNScalar) (2 * (y - viewport.YCenter())) / (RNScalar) viewport.Height();
     R3Point far_org = camera.Origin() + camera.Towards() * camera.Far();
     R3Vector far_right = camera.Right() * camera.Far() * tan(camera.XFOV());
     R3Vector far_up = camera.Up() * camera.Far() * tan(camera.YFOV());
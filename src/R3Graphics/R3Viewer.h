@@ -70,6 +70,7 @@ class R3Viewer {
 
 	// Camera/viewport relationship functions/operators
 	const R3Ray WorldRay(int x, int y) const;
+	const R3Ray WorldRay(RNScalar x, RNScalar y) const;
 	const R2Point ViewportPoint(const R3Point& point) const;
 	const R2Box ViewportBBox(const R3Shape& shape) const;
 	const R2Circle ViewportBCircle(const R3Shape& shape) const;
@@ -761,38 +761,17 @@ RNClassID R3Intersects(const R3Ray& ray, const R3Halfspace& halfspace,
 RNClassID R3Intersects(const R3Ray& ray, const R3Triangle& triangle, 
     R3Point *hit_point, R3Vector *hit_normal, RNScalar *hit_t)
 {
-    // Find intersection of ray and plane
-    R3Point p1;
-    RNScalar t1;
-    switch (R3Intersects(ray, triangle.Plane(), &p1, &t1)) {
-    case RN_NULL_CLASS_ID:
-	// Ray does not intersect triangle plane
-	return RN_NULL_CLASS_ID;
-	
-    case R3_POINT_CLASS_ID:
-	// Ray intersects triangle plane in a single point
-	// Check whether triangle contains intersection point
-	if (!R3Contains(triangle, p1)) return RN_NULL_CLASS_ID;
-	if (hit_point) *hit_point = p1;
-	if (hit_normal) *hit_normal = triangle.Normal();
-	if (hit_t) *hit_t = t1;
-	return R3_POINT_CLASS_ID;
-
-    case R3_RAY_CLASS_ID: 
-	// Ray lies in triangle plane 
-	// Intersect ray and triangle in 2D
-	// RNAbort("Case not implemented");
-	// return R3_SPAN_CLASS_ID;
+    // Intersect with watertight test (rays in triangle plane do not hit)
+    RNScalar t;
+    R3TriangleRay triangle_ray(ray);
+    if (!triangle_ray.Intersects(triangle.V0()->Position(), triangle.V1()->Position(), triangle.V2()->Position(), FLT_MAX, &t))
 	return RN_NULL_CLASS_ID;
 
-    default:
-	RNAbort("Invalid intersection result");
-	break;
-    }
-
-    // Should never get here
-    RNAbort("Should never get here");
-    return RN_NULL_CLASS_ID;
+    // Ray intersects triangle in a single point
+    if (hit_point) *hit_point = ray.Point(t);
+    if (hit_normal) *hit_normal = triangle.Normal();
+    if (hit_t) *hit_t = t;
+    return R3_POINT_CLASS_ID;
 }
 
 
@@ -800,9 +779,9 @@ RNClassID R3Intersects(const R3Ray& ray, const R3Triangle& triangle,
 RNClassID R3Intersects(const R3Ray& ray, const R3TriangleArray& array,
     R3Point *hit_point, R3Vector *hit_normal, RNScalar *hit_t)
 {
-    // This could be more efficient ???
-    // Sort intersections with front-facing planes 
-    //   before do any point-in-triangle operations
+    // Use bounding volume hierarchy if there is one
+    const R3TriangleBVH *bvh = array.BVH();
+    if (bvh) return bvh->FindIntersection(ray, hit_point, hit_normal, hit_t);
 
     // Check bounding volume for intersection 
     if (!R3Intersects(ray, array.Box())) 
@@ -811,17 +790,13 @@ RNClassID R3Intersects(const R3Ray& ray, const R3TriangleArray& array,
     // Check each triangle for intersection
     RNClassID status = RN_NULL_CLASS_ID;
     RNScalar min_t = FLT_MAX;
+    R3TriangleRay triangle_ray(ray);
     for (int i = 0; i < array.NTriangles(); i++) {
-        R3Point point;
-        R3Vector normal;
-	RNScalar t;
-        if (R3Intersects(ray, *(array.Triangle(i)), &point, &normal, &t) == R3_POINT_CLASS_ID) {
-	    if (t < min_t) {
-	        status = R3_POINT_CLASS_ID;
-	        if (hit_point) *hit_point = point;
-	        if (hit_normal) *hit_normal = normal;
-	        min_t = t;
-	    }
+        R3Triangle *triangle = array.Triangle(i);
+        if (triangle_ray.Intersects(triangle->V0()->Position(), triangle->V1()->Position(), triangle->V2()->Position(), min_t, &min_t)) {
+	    status = R3_POINT_CLASS_ID;
+	    if (hit_point) *hit_point = ray.Point(min_t);
+	    if (hit_normal) *hit_normal = triangle->Normal();
 	}
     }
 
@@ -1285,6 +1260,52 @@ RNClassID R3Intersects(const R3Ray& ray, const R3Shape& shape,
 
 
 
+RNBoolean R3Occluded(const R3Ray& ray, const R3Triangle& triangle, RNScalar max_t)
+{
+    // Return whether ray hits triangle with 0 <= t < max_t
+    R3TriangleRay triangle_ray(ray);
+    return triangle_ray.Intersects(triangle.V0()->Position(), triangle.V1()->Position(), triangle.V2()->Position(), max_t, NULL);
+}
+
+
+
+RNBoolean R3Occluded(const R3Ray& ray, const R3TriangleArray& array, RNScalar max_t)
+{
+    // Use bounding volume hierarchy if there is one
+    const R3TriangleBVH *bvh = array.BVH();
+    if (bvh) return bvh->FindAnyIntersection(ray, max_t);
+
+    // Check bounding volume for intersection 
+    if (!R3Intersects(ray, array.Box())) return FALSE;
+
+    // Stop at first triangle hit
+    R3TriangleRay triangle_ray(ray);
+    for (int i = 0; i < array.NTriangles(); i++) {
+        R3Triangle *triangle = array.Triangle(i);
+        if (triangle_ray.Intersects(triangle->V0()->Position(), triangle->V1()->Position(), triangle->V2()->Position(), max_t, NULL))
+            return TRUE;
+    }
+
+    // No triangle hit
+    return FALSE;
+}
+
+
+
+RNBoolean R3Occluded(const R3Ray& ray, const R3Shape& shape, RNScalar max_t)
+{
+    // Use any-hit tests for triangles
+    if (shape.ClassID() == R3TriangleArray::CLASS_ID()) return R3Occluded(ray, (const R3TriangleArray&) shape, max_t);
+    if (shape.ClassID() == R3Triangle::CLASS_ID()) return R3Occluded(ray, (const R3Triangle&) shape, max_t);
+
+    // Check first hit of other shapes
+    RNScalar t;
+    if (!shape.Intersects(ray, NULL, NULL, &t)) return FALSE;
+    return ((t >= 0) && (t < max_t)) ? TRUE : FALSE;
+}
+
+
+
 RNClassID R3Intersects(const R3Span& span1, const R3Span& span2, 
     R3Point *hit_point, RNScalar *hit_t1, RNScalar *hit_t2)
 {
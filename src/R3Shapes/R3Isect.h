@@ -72,6 +72,10 @@ RNClassID R3Intersects(const R3Ray& ray, const R3Cone& cone,
 RNClassID R3Intersects(const R3Ray& ray, const R3Shape& shape, 
     R3Point *hit_point = NULL, R3Vector *hit_normal = NULL, RNScalar *hit_t = NULL);
 
+RNBoolean R3Occluded(const R3Ray& ray, const R3Triangle& triangle, RNScalar max_t);
+RNBoolean R3Occluded(const R3Ray& ray, const R3TriangleArray& array, RNScalar max_t);
+RNBoolean R3Occluded(const R3Ray& ray, const R3Shape& shape, RNScalar max_t);
+
 RNClassID R3Intersects(const R3Span& span, const R3Point& point, 
     RNScalar *hit_t = NULL);
 RNClassID R3Intersects(const R3Span& span, const R3Line& line, 
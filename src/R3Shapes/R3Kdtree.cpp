@@ -498,19 +498,84 @@ FindClosest(const R3Point& query_position,
 // Finding the closest K points to a query point
 ////////////////////////////////////////////////////////////////////////
 
+// Closest points are kept in a bounded max-heap keyed by squared distance,
+// so the furthest point found so far is always at index zero.
+
+template <class PtrType>
+static inline void
+R3KdtreeInsertClosest(PtrType point, RNLength distance_squared, int max_points,
+  PtrType *points, RNLength *distances_squared, int& npoints)
+{
+  // Find slot for point
+  int i;
+  if (npoints < max_points) {
+    // Sift up from bottom of heap
+    i = npoints++;
+    while (i > 0) {
+      int parent = (i - 1) / 2;
+      if (distances_squared[parent] >= distance_squared) break;
+      points[i] = points[parent];
+      distances_squared[i] = distances_squared[parent];
+      i = parent;
+    }
+  }
+  else {
+    // Replace furthest point and sift down
+    if (distance_squared >= distances_squared[0]) return;
+    i = 0;
+    while (TRUE) {
+      int child = 2 * i + 1;
+      if (child >= npoints) break;
+      if ((child + 1 < npoints) && (distances_squared[child + 1] > distances_squared[child])) child++;
+      if (distances_squared[child] <= distance_squared) break;
+      points[i] = points[child];
+      distances_squared[i] = distances_squared[child];
+      i = child;
+    }
+  }
+
+  // Store point
+  points[i] = point;
+  distances_squared[i] = distance_squared;
+}
+
+
+
+template <class PtrType>
+static inline void
+R3KdtreeSortClosest(PtrType *points, RNLength *distances_squared, int npoints)
+{
+  // Heapsort max-heap into increasing order of distance
+  for (int n = npoints - 1; n > 0; n--) {
+    PtrType point = points[n];
+    RNLength distance_squared = distances_squared[n];
+    points[n] = points[0];
+    distances_squared[n] = distances_squared[0];
+    int i = 0;
+    while (TRUE) {
+      int child = 2 * i + 1;
+      if (child >= n) break;
+      if ((child + 1 < n) && (distances_squared[child + 1] > distances_squared[child])) child++;
+      if (distances_squared[child] <= distance_squared) break;
+      points[i] = points[child];
+      distances_squared[i] = distances_squared[child];
+      i = child;
+    }
+    points[i] = point;
+    distances_squared[i] = distance_squared;
+  }
+}
+
+
+
 template <class PtrType>
 void R3Kdtree<PtrType>::
 FindClosest(R3KdtreeNode<PtrType> *node, const R3Box& node_box, 
   PtrType query_point, const R3Point& query_position, 
-  RNScalar min_distance_squared, RNScalar max_distance_squared, int max_points,
+  RNScalar min_distance_squared, RNScalar& max_distance_squared, int max_points,
   int (*IsCompatible)(PtrType, PtrType, void *), void *compatible_data, 
-  RNArray<PtrType>& points, RNLength *distances_squared) const
+  PtrType *points, RNLength *distances_squared, int& npoints) const
 {
-  // Update max distance squared
-  if (points.NEntries() == max_points) {
-    max_distance_squared = distances_squared[max_points-1];
-  }
-
   // Check if node is interior
   if (node->children[0]) {
     assert(node->children[1]);
@@ -544,21 +609,18 @@ FindClosest(R3KdtreeNode<PtrType> *node, const R3Box& node_box,
     // Compute distance from point to split plane
     RNLength side = query_position[node->split_dimension] - node->split_coordinate;
 
-    // Search children nodes
-    if ((side <= 0) || (side*side <= max_distance_squared)) {
-      // Search negative side 
+    // Search nearer child first, so the radius shrinks before the other is visited
+    int near_child = (side <= 0) ? 0 : 1;
+    for (int k = 0; k < 2; k++) {
+      int c = (k == 0) ? near_child : 1 - near_child;
+      if ((c == 0) && (side > 0) && (side*side > max_distance_squared)) continue;
+      if ((c == 1) && (side < 0) && (side*side > max_distance_squared)) continue;
       R3Box child_box(node_box);
-      child_box[RN_HI][node->split_dimension] = node->split_coordinate;
-      FindClosest(node->children[0], child_box, query_point, query_position, 
+      if (c == 0) child_box[RN_HI][node->split_dimension] = node->split_coordinate;
+      else child_box[RN_LO][node->split_dimension] = node->split_coordinate;
+      FindClosest(node->children[c], child_box, query_point, query_position, 
         min_distance_squared, max_distance_squared, max_points, IsCompatible, compatible_data,
-        points, distances_squared);
-    }
-    if ((side >= 0) || (side*side <= max_distance_squared)) {
-      R3Box child_box(node_box);
-      child_box[RN_LO][node->split_dimension] = node->split_coordinate;
-      FindClosest(node->children[1], child_box, query_point, query_position, 
-        min_distance_squared, max_distance_squared, max_points, IsCompatible, compatible_data,
-        points, distances_squared);
+        points, distances_squared, npoints);
     }
   }
   else {
@@ -572,22 +634,11 @@ FindClosest(R3KdtreeNode<PtrType> *node, const R3Box& node_box,
         // Check if point is compatible
         if (!IsCompatible || !query_point || IsCompatible(query_point, point, compatible_data)) {
 
-          // Find slot for point (points are sorted by distance)
-          int slot = 0;
-          while (slot < points.NEntries()) {
-            if (distance_squared < distances_squared[slot]) break;
-            slot++;
-          }
-          
-          // Insert point and distance into sorted arrays
-          if (slot < max_points) {
-            int first = points.NEntries();
-            if (first >= max_points) first = max_points-1;
-            for (int j = first; j > slot; j--) distances_squared[j] = distances_squared[j-1];
-            distances_squared[slot] = distance_squared;
-            points.InsertKth(point, slot);
-            points.Truncate(max_points);
-          }
+          // Insert point into heap
+          R3KdtreeInsertClosest(point, distance_squared, max_points, points, distances_squared, npoints);
+
+          // Shrink search radius once heap is full
+          if (npoints == max_points) max_distance_squared = distances_squared[0];
         }
       }
     }
@@ -596,89 +647,134 @@ FindClosest(R3KdtreeNode<PtrType> *node, const R3Box& node_box,
 
 
 
-template <class PtrType>
-int R3Kdtree<PtrType>::
-FindClosest(PtrType query_point, RNScalar min_distance, RNScalar max_distance, int max_points, 
-  RNArray<PtrType>& points, RNLength *distances) const
-{
-  // Find closest within some distance
-  return FindClosest(query_point, min_distance, max_distance, max_points, NULL, NULL, points, distances);
-}
-
-
-
-
 template <class PtrType>
 int R3Kdtree<PtrType>::
 FindClosest(PtrType query_point, 
   RNScalar min_distance, RNScalar max_distance, int max_points, 
   int (*IsCompatible)(PtrType, PtrType, void *), void *compatible_data, 
-  RNArray<PtrType>& points, RNLength *distances) const
+  PtrType *points, RNLength *distances_squared) const
 {
   // Check root
-  if (!root) return 0;
+  if (!root || (max_points <= 0)) return 0;
 
   // Use squared distances for efficiency
   RNLength min_distance_squared = min_distance * min_distance;
   RNLength max_distance_squared = max_distance * max_distance;
 
-  // Allocate temporary array of squared distances to max_points closest points
-  RNLength *distances_squared = new RNLength [ max_points ];
-
   // Search nodes recursively
+  int npoints = 0;
   FindClosest(root, bbox, 
     query_point, Position(query_point),
     min_distance_squared, max_distance_squared, max_points, 
     IsCompatible, compatible_data,
-    points, distances_squared);
-
-  // Update return distances
-  if (distances) {
-    for (int i = 0; i < points.NEntries(); i++) {
-      distances[i] = sqrt(distances_squared[i]);
-    }
-  }
-
-  // Delete temporary array of squared distances
-  delete [] distances_squared;
+    points, distances_squared, npoints);
 
   // Return number of points
-  return points.NEntries();
+  return npoints;
 }
 
 
 
 template <class PtrType>
 int R3Kdtree<PtrType>::
-FindClosest(const R3Point& query_position, RNScalar min_distance, RNScalar max_distance, int max_points, 
-  RNArray<PtrType>& points, RNLength *distances) const
+FindClosest(const R3Point& query_position, 
+  RNScalar min_distance, RNScalar max_distance, int max_points, 
+  PtrType *points, RNLength *distances_squared) const
 {
   // Check root
-  if (!root) return 0;
+  if (!root || (max_points <= 0)) return 0;
 
   // Use squared distances for efficiency
   RNLength min_distance_squared = min_distance * min_distance;
   RNLength max_distance_squared = max_distance * max_distance;
 
-  // Allocate temporary array of squared distances to max_points closest points
-  RNLength *distances_squared = new RNLength [ max_points ];
-
   // Search nodes recursively
+  int npoints = 0;
   FindClosest(root, bbox, 
     NULL, query_position, 
     min_distance_squared, max_distance_squared, max_points, 
     NULL, NULL, 
-    points, distances_squared);
+    points, distances_squared, npoints);
 
-  // Update return distances
-  if (distances) {
-    for (int i = 0; i < points.NEntries(); i++) {
-      distances[i] = sqrt(distances_squared[i]);
-    }
+  // Return number of points
+  return npoints;
+}
+
+
+
+template <class PtrType>
+int R3Kdtree<PtrType>::
+FindClosest(PtrType query_point, RNScalar min_distance, RNScalar max_distance, int max_points, 
+  RNArray<PtrType>& points, RNLength *distances) const
+{
+  // Find closest within some distance
+  return FindClosest(query_point, min_distance, max_distance, max_points, NULL, NULL, points, distances);
+}
+
+
+
+
+template <class PtrType>
+int R3Kdtree<PtrType>::
+FindClosest(PtrType query_point, 
+  RNScalar min_distance, RNScalar max_distance, int max_points, 
+  int (*IsCompatible)(PtrType, PtrType, void *), void *compatible_data, 
+  RNArray<PtrType>& points, RNLength *distances) const
+{
+  // Check arguments
+  if (!root || (max_points <= 0)) return 0;
+
+  // Allocate temporary heap of closest points
+  PtrType *heap_points = new PtrType [ max_points ];
+  RNLength *heap_distances_squared = new RNLength [ max_points ];
+
+  // Find closest points and sort them by distance
+  int npoints = FindClosest(query_point, min_distance, max_distance, max_points,
+    IsCompatible, compatible_data, heap_points, heap_distances_squared);
+  R3KdtreeSortClosest(heap_points, heap_distances_squared, npoints);
+
+  // Fill return arrays
+  for (int i = 0; i < npoints; i++) {
+    points.Insert(heap_points[i]);
+    if (distances) distances[i] = sqrt(heap_distances_squared[i]);
   }
 
-  // Delete temporary array of squared distances
-  delete [] distances_squared;
+  // Delete temporary heap
+  delete [] heap_points;
+  delete [] heap_distances_squared;
+
+  // Return number of points
+  return points.NEntries();
+}
+
+
+
+template <class PtrType>
+int R3Kdtree<PtrType>::
+FindClosest(const R3Point& query_position, RNScalar min_distance, RNScalar max_distance, int max_points, 
+  RNArray<PtrType>& points, RNLength *distances) const
+{
+  // Check arguments
+  if (!root || (max_points <= 0)) return 0;
+
+  // Allocate temporary heap of closest points
+  PtrType *heap_points = new PtrType [ max_points ];
+  RNLength *heap_distances_squared = new RNLength [ max_points ];
+
+  // Find closest points and sort them by distance
+  int npoints = FindClosest(query_position, min_distance, max_distance, max_points,
+    heap_points, heap_distances_squared);
+  R3KdtreeSortClosest(heap_points, heap_distances_squared, npoints);
+
+  // Fill return arrays
+  for (int i = 0; i < npoints; i++) {
+    points.Insert(heap_points[i]);
+    if (distances) distances[i] = sqrt(heap_distances_squared[i]);
+  }
+
+  // Delete temporary heap
+  delete [] heap_points;
+  delete [] heap_distances_squared;
 
   // Return number of points
   return points.NEntries();
@@ -827,6 +923,72 @@ FindAll(const R3Point& query_position, RNScalar min_distance, RNScalar max_dista
 
 
 
+////////////////////////////////////////////////////////////////////////
+// Visiting all points within some distance to a query point
+////////////////////////////////////////////////////////////////////////
+
+template <class PtrType>
+template <class Visitor>
+void R3Kdtree<PtrType>::
+ForEachWithin(R3KdtreeNode<PtrType> *node, const R3Box& node_box, 
+  const R3Point& query_position, RNScalar max_distance_squared, 
+  Visitor& visitor) const
+{
+  // Check if node is interior
+  if (node->children[0]) {
+    assert(node->children[1]);
+
+    // Check distance from point to node box
+    RNLength distance_squared = 0;
+    for (int dim = RN_X; dim <= RN_Z; dim++) {
+      RNLength d = 0;
+      if (query_position[dim] > node_box[RN_HI][dim]) d = query_position[dim] - node_box[RN_HI][dim];
+      else if (query_position[dim] < node_box[RN_LO][dim]) d = node_box[RN_LO][dim] - query_position[dim];
+      distance_squared += d * d;
+    }
+    if (distance_squared > max_distance_squared) return;
+
+    // Compute distance from point to split plane
+    RNLength side = query_position[node->split_dimension] - node->split_coordinate;
+
+    // Visit children nodes
+    if ((side <= 0) || (side*side <= max_distance_squared)) {
+      R3Box child_box(node_box);
+      child_box[RN_HI][node->split_dimension] = node->split_coordinate;
+      ForEachWithin(node->children[0], child_box, query_position, max_distance_squared, visitor);
+    }
+    if ((side >= 0) || (side*side <= max_distance_squared)) {
+      R3Box child_box(node_box);
+      child_box[RN_LO][node->split_dimension] = node->split_coordinate;
+      ForEachWithin(node->children[1], child_box, query_position, max_distance_squared, visitor);
+    }
+  }
+  else {
+    // Visit points
+    for (int i = 0; i < node->npoints; i++) {
+      PtrType point = node->points[i];
+      RNLength distance_squared = R3SquaredDistance(query_position, Position(point));
+      if (distance_squared <= max_distance_squared) visitor(point, distance_squared);
+    }
+  }
+}
+
+
+
+template <class PtrType>
+template <class Visitor>
+void R3Kdtree<PtrType>::
+ForEachWithin(const R3Point& query_position, RNLength max_distance, Visitor& visitor) const
+{
+  // Check root
+  if (!root) return;
+
+  // Visit nodes recursively
+  ForEachWithin(root, bbox, query_position, max_distance * max_distance, visitor);
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////
 // Finding the any one point to a query point
 ////////////////////////////////////////////////////////////////////////
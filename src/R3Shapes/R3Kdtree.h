@@ -75,6 +75,17 @@ public:
     RNLength min_distance, RNLength max_distance, int max_points, 
     RNArray<PtrType>& points, RNLength *distances = NULL) const;
 
+  // Search for closest K into caller-supplied arrays with room for max_points
+  // entries (no memory is allocated).  Results are a max-heap on squared
+  // distance, so points[0] is the furthest of the points found.
+  int FindClosest(PtrType query_point, 
+    RNLength min_distance, RNLength max_distance, int max_points, 
+    int (*IsCompatible)(PtrType, PtrType, void *), void *compatible_data, 
+    PtrType *points, RNLength *distances_squared) const;
+  int FindClosest(const R3Point& query_position, 
+    RNLength min_distance, RNLength max_distance, int max_points, 
+    PtrType *points, RNLength *distances_squared) const;
+
   // Search for all within some distance 
   int FindAll(PtrType query_point, 
     RNLength min_distance, RNLength max_distance, 
@@ -96,6 +107,11 @@ public:
     RNLength min_distance, RNLength max_distance, 
     RNArray<PtrType>& points) const;
 
+  // Call visitor(point, distance_squared) for all within some distance (without collecting them)
+  template <class Visitor>
+  void ForEachWithin(const R3Point& query_position, 
+    RNLength max_distance, Visitor& visitor) const;
+
   // Search for any one 
   PtrType FindAny(PtrType query_point, 
     RNLength min_distance, RNLength max_distance, 
@@ -117,9 +133,9 @@ public:
     PtrType& closest_point, RNLength& closest_distance_squared) const;
   void FindClosest(R3KdtreeNode<PtrType> *node, const R3Box& node_box, 
     PtrType query_point, const R3Point& query_position, 
-    RNLength min_distance_squared, RNLength max_distance_squared, int max_points, 
+    RNLength min_distance_squared, RNLength& max_distance_squared, int max_points, 
     int (*IsCompatible)(PtrType, PtrType, void *), void *compatible_data, 
-    RNArray<PtrType>& points, RNLength *distances_squared) const;
+    PtrType *points, RNLength *distances_squared, int& npoints) const;
   void FindAll(R3KdtreeNode<PtrType> *node, const R3Box& node_box, 
     PtrType query_point, const R3Point& position, 
     RNLength min_distance_squared, RNLength max_distance_squared, 
@@ -146,6 +162,10 @@ public:
     const Shape& query_plane, 
     RNLength min_distance, RNLength max_distance, 
     RNArray<PtrType>& points) const;
+  template <class Visitor>
+  void ForEachWithin(R3KdtreeNode<PtrType> *node, const R3Box& node_box, 
+    const R3Point& query_position, RNScalar max_distance_squared, 
+    Visitor& visitor) const;
 
   // Internal manipulation functions
   void InsertPoint(R3KdtreeNode<PtrType> *node, const R3Box& node_box, PtrType point);
@@ -37,6 +37,8 @@ class R3Ellipsoid;
 class R3Surface;
 class R3Triangle;
 class R3TriangleArray;
+class R3TriangleBVH;
+class R3TriangleRay;
 class R3Circle;
 class R3Ellipse;
 class R3Mesh;
@@ -94,6 +96,7 @@ class R3Grid;
 
 #include "R3Shapes/R3Surface.h"
 #include "R3Shapes/R3Triangle.h"
+#include "R3Shapes/R3TriangleRay.h"
 #include "R3Shapes/R3TriangleArray.h"
 #include "R3Shapes/R3Circle.h"
 #include "R3Shapes/R3Ellipse.h"
@@ -137,6 +140,7 @@ class R3Grid;
 /* Mesh utility include files */
 
 #include "R3Shapes/R3MeshSearchTree.h"
+#include "R3Shapes/R3TriangleBVH.h"
 #include "R3Shapes/R3MeshProperty.h"
 #include "R3Shapes/R3MeshPropertySet.h"
 
@@ -34,7 +34,8 @@ R3StopTriangleArray()
 
 R3TriangleArray::
 R3TriangleArray(void)
-    : bbox(R3null_box)
+    : bbox(R3null_box),
+      bvh(NULL)
 {
 }
 
@@ -44,8 +45,11 @@ R3TriangleArray::
 R3TriangleArray(const R3TriangleArray& array)
   : vertices(array.vertices),
     triangles(array.triangles),
-    bbox(array.bbox)
+    bbox(array.bbox),
+    bvh(NULL)
 {
+    // Build own hierarchy if copied array had one
+    if (array.bvh) BuildBVH();
 }
 
 
@@ -54,7 +58,8 @@ R3TriangleArray::
 R3TriangleArray(const RNArray<R3TriangleVertex *>& vertices, const RNArray<R3Triangle *>& triangles)
   : vertices(vertices),
     triangles(triangles),
-    bbox(R3null_box)
+    bbox(R3null_box),
+    bvh(NULL)
 {
     // Update bounding box
     Update();
@@ -62,6 +67,15 @@ R3TriangleArray(const RNArray<R3TriangleVertex *>& vertices, const RNArray<R3Tri
 
 
 
+R3TriangleArray::
+~R3TriangleArray(void)
+{
+    // Delete bounding volume hierarchy
+    DeleteBVH();
+}
+
+
+
 const RNBoolean R3TriangleArray::
 IsPoint (void) const
 {
@@ -388,6 +402,29 @@ Update(void)
       R3TriangleVertex *v = vertices.Kth(i);
       bbox.Union(v->Position());
     }
+
+    // Rebuild bounding volume hierarchy if there is one
+    if (bvh) BuildBVH();
+}
+
+
+
+void R3TriangleArray::
+BuildBVH(void)
+{
+    // Build bounding volume hierarchy over current triangles
+    DeleteBVH();
+    bvh = new R3TriangleBVH(*this);
+}
+
+
+
+void R3TriangleArray::
+DeleteBVH(void)
+{
+    // Delete bounding volume hierarchy
+    if (bvh) delete bvh;
+    bvh = NULL;
 }
 
 
@@ -17,6 +17,7 @@ class R3TriangleArray : public R3Surface {
         R3TriangleArray(void);
         R3TriangleArray(const R3TriangleArray& array);
         R3TriangleArray(const RNArray<R3TriangleVertex *>& vertices, const RNArray<R3Triangle *>& triangles);
+        virtual ~R3TriangleArray(void);
 
         // Triangle array properties
         const R3Box& Box(void) const;
@@ -29,6 +30,9 @@ class R3TriangleArray : public R3Surface {
         int NTriangles(void) const;
 	R3Triangle *Triangle(int index) const;
 
+	// Acceleration structure access functions
+	const R3TriangleBVH *BVH(void) const;
+
         // Shape property functions/operators
 	virtual const RNBoolean IsPoint(void) const;
 	virtual const RNBoolean IsLinear(void) const;
@@ -51,6 +55,8 @@ class R3TriangleArray : public R3Surface {
         virtual void Subdivide(RNLength max_edge_length);
 	virtual void MoveVertex(R3TriangleVertex *vertex, const R3Point& position);
 	virtual void Update(void);  
+	virtual void BuildBVH(void);
+	virtual void DeleteBVH(void);
 
         // Draw functions/operators
         virtual void Draw(const R3DrawFlags draw_flags = R3_DEFAULT_DRAW_FLAGS) const;
@@ -63,6 +69,7 @@ class R3TriangleArray : public R3Surface {
 	RNArray<R3TriangleVertex *> vertices;
 	RNArray<R3Triangle *> triangles;
         R3Box bbox;
+        R3TriangleBVH *bvh;
 };
 
 
@@ -114,6 +121,15 @@ Triangle(int k) const
 
 
 
+inline const R3TriangleBVH *R3TriangleArray::
+BVH(void) const
+{
+    // Return bounding volume hierarchy (NULL if not built)
+    return bvh;
+}
+
+
+
 
 
 
@@ -0,0 +1,427 @@
+// Source file for triangle bounding volume hierarchy class
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Include files
+////////////////////////////////////////////////////////////////////////
+
+#include "R3Shapes/R3Shapes.h"
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Constants
+////////////////////////////////////////////////////////////////////////
+
+// Number of centroid bins evaluated per split
+static const int R3bvh_nbins = 16;
+
+// Cost of traversing a node relative to intersecting a triangle
+static const RNScalar R3bvh_traversal_cost = 0.125;
+
+// Deepest tree that fits on the traversal stack
+static const int R3bvh_max_depth = 60;
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Node definition
+////////////////////////////////////////////////////////////////////////
+
+struct R3TriangleBVHNode {
+  // Bounding box (lo/hi, xyz)
+  RNCoord box[2][3];
+
+  // First packet (leaf) or index of second child (interior)
+  int index;
+
+  // Number of triangles (zero for interior nodes)
+  int ntriangles;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Constructor/destructor
+////////////////////////////////////////////////////////////////////////
+
+R3TriangleBVH::
+R3TriangleBVH(const R3TriangleArray& array)
+  : triangles(NULL),
+    ntriangles(array.NTriangles()),
+    packets(NULL),
+    packet_triangles(NULL),
+    npackets(0),
+    nodes(NULL),
+    nnodes(0),
+    bbox(R3null_box)
+{
+  // Check number of triangles
+  if (ntriangles == 0) return;
+
+  // Copy triangles and compute their boxes and centroids
+  triangles = new R3Triangle * [ ntriangles ];
+  R3Box *triangle_boxes = new R3Box [ ntriangles ];
+  R3Point *centroids = new R3Point [ ntriangles ];
+  for (int i = 0; i < ntriangles; i++) {
+    R3Triangle *triangle = array.Triangle(i);
+    triangles[i] = triangle;
+    triangle_boxes[i] = triangle->BBox();
+    centroids[i] = triangle_boxes[i].Centroid();
+    bbox.Union(triangle_boxes[i]);
+  }
+
+  // Build tree (a binary tree has at most 2n-1 nodes)
+  nodes = new R3TriangleBVHNode [ 2 * ntriangles - 1 ];
+  Build(0, ntriangles, triangle_boxes, centroids, 0);
+
+  // Copy vertices of leaf triangles into packets
+  BuildPackets();
+
+  // Delete temporary data
+  delete [] triangle_boxes;
+  delete [] centroids;
+}
+
+
+
+R3TriangleBVH::
+~R3TriangleBVH(void)
+{
+  // Delete nodes, packets, and triangle order
+  if (nodes) delete [] nodes;
+  if (packets) delete [] packets;
+  if (packet_triangles) delete [] packet_triangles;
+  if (triangles) delete [] triangles;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Build functions
+////////////////////////////////////////////////////////////////////////
+
+static RNArea
+HalfArea(const R3Box& box)
+{
+  // Return half the surface area of box (empty boxes have none)
+  if (box.IsEmpty()) return 0;
+  RNLength dx = box.XLength();
+  RNLength dy = box.YLength();
+  RNLength dz = box.ZLength();
+  return dx*dy + dx*dz + dy*dz;
+}
+
+
+
+int R3TriangleBVH::
+Build(int first, int n, R3Box *triangle_boxes, R3Point *centroids, int depth)
+{
+  // Allocate node
+  int index = nnodes++;
+  R3TriangleBVHNode *node = &nodes[index];
+
+  // Compute bounding box of triangles and of their centroids
+  R3Box node_box = R3null_box;
+  R3Box centroid_box = R3null_box;
+  for (int i = first; i < first + n; i++) {
+    node_box.Union(triangle_boxes[i]);
+    centroid_box.Union(centroids[i]);
+  }
+
+  // Store box padded by tolerance of triangle intersection test
+  for (int dim = RN_X; dim <= RN_Z; dim++) {
+    node->box[RN_LO][dim] = node_box[RN_LO][dim] - RN_EPSILON;
+    node->box[RN_HI][dim] = node_box[RN_HI][dim] + RN_EPSILON;
+  }
+
+  // Find best binned split along longest axis of centroids
+  RNDimension dim = centroid_box.LongestAxis();
+  RNCoord min_coord = centroid_box[RN_LO][dim];
+  RNLength extent = centroid_box[RN_HI][dim] - min_coord;
+  int best_split = -1;
+  RNScalar best_cost = n;
+  if ((n > 1) && (extent > 0) && (depth < R3bvh_max_depth)) {
+    // Sort centroids into bins
+    R3Box bin_boxes[R3bvh_nbins];
+    int bin_counts[R3bvh_nbins];
+    for (int b = 0; b < R3bvh_nbins; b++) {
+      bin_boxes[b] = R3null_box;
+      bin_counts[b] = 0;
+    }
+    RNScalar bin_scale = R3bvh_nbins / extent;
+    for (int i = first; i < first + n; i++) {
+      int b = (int) ((centroids[i][dim] - min_coord) * bin_scale);
+      if (b >= R3bvh_nbins) b = R3bvh_nbins - 1;
+      bin_boxes[b].Union(triangle_boxes[i]);
+      bin_counts[b]++;
+    }
+
+    // Sweep from the right to get area and count of right sides
+    RNArea right_areas[R3bvh_nbins];
+    int right_counts[R3bvh_nbins];
+    R3Box right_box = R3null_box;
+    int right_count = 0;
+    for (int b = R3bvh_nbins - 1; b > 0; b--) {
+      right_box.Union(bin_boxes[b]);
+      right_count += bin_counts[b];
+      right_areas[b] = HalfArea(right_box);
+      right_counts[b] = right_count;
+    }
+
+    // Sweep from the left and evaluate surface area heuristic
+    RNArea node_area = HalfArea(node_box);
+    R3Box left_box = R3null_box;
+    int left_count = 0;
+    for (int b = 0; b < R3bvh_nbins - 1; b++) {
+      left_box.Union(bin_boxes[b]);
+      left_count += bin_counts[b];
+      if ((left_count == 0) || (right_counts[b+1] == 0)) continue;
+      RNScalar cost = R3bvh_traversal_cost;
+      if (node_area > 0) cost += (HalfArea(left_box) * left_count + right_areas[b+1] * right_counts[b+1]) / node_area;
+      else cost += n;
+      if ((best_split < 0) || (cost < best_cost)) {
+        best_split = b;
+        best_cost = cost;
+      }
+    }
+
+    // Keep small leaves when splitting does not pay off
+    if ((n <= max_leaf_triangles) && (best_cost >= n)) best_split = -1;
+  }
+
+  // Create leaf
+  if (best_split < 0) {
+    node->index = first;
+    node->ntriangles = n;
+    return index;
+  }
+
+  // Partition triangles on split bin
+  int i = first;
+  int j = first + n - 1;
+  RNScalar bin_scale = R3bvh_nbins / extent;
+  while (i <= j) {
+    int b = (int) ((centroids[i][dim] - min_coord) * bin_scale);
+    if (b >= R3bvh_nbins) b = R3bvh_nbins - 1;
+    if (b <= best_split) { i++; continue; }
+    R3Triangle *swap_triangle = triangles[i]; triangles[i] = triangles[j]; triangles[j] = swap_triangle;
+    R3Box swap_box = triangle_boxes[i]; triangle_boxes[i] = triangle_boxes[j]; triangle_boxes[j] = swap_box;
+    R3Point swap_centroid = centroids[i]; centroids[i] = centroids[j]; centroids[j] = swap_centroid;
+    j--;
+  }
+  int nleft = i - first;
+  assert((nleft > 0) && (nleft < n));
+
+  // Build children (first child directly follows node)
+  node->ntriangles = 0;
+  Build(first, nleft, triangle_boxes, centroids, depth + 1);
+  int second = Build(first + nleft, n - nleft, triangle_boxes, centroids, depth + 1);
+  nodes[index].index = second;
+
+  // Return node index
+  return index;
+}
+
+
+
+void R3TriangleBVH::
+BuildPackets(void)
+{
+  // Count packets of leaves
+  for (int i = 0; i < nnodes; i++) {
+    int n = nodes[i].ntriangles;
+    npackets += (n + R3_TRIANGLE_PACKET_SIZE - 1) / R3_TRIANGLE_PACKET_SIZE;
+  }
+
+  // Fill packets leaf by leaf (leaves then point at their first packet)
+  packets = new R3TrianglePacket [ npackets ];
+  packet_triangles = new R3Triangle * [ npackets * R3_TRIANGLE_PACKET_SIZE ];
+  int k = 0;
+  for (int i = 0; i < nnodes; i++) {
+    R3TriangleBVHNode& node = nodes[i];
+    if (node.ntriangles == 0) continue;
+    int first = node.index;
+    node.index = k;
+    for (int j = 0; j < node.ntriangles; j += R3_TRIANGLE_PACKET_SIZE) {
+      R3TrianglePacket& packet = packets[k];
+      for (int lane = 0; lane < R3_TRIANGLE_PACKET_SIZE; lane++) {
+        R3Triangle *triangle = (j + lane < node.ntriangles) ? triangles[first + j + lane] : NULL;
+        if (triangle) packet.SetTriangle(lane, triangle->V0()->Position(), triangle->V1()->Position(), triangle->V2()->Position());
+        else packet.SetEmpty(lane);
+        packet_triangles[k * R3_TRIANGLE_PACKET_SIZE + lane] = triangle;
+      }
+      k++;
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Ray intersection functions
+////////////////////////////////////////////////////////////////////////
+
+static inline RNBoolean
+IntersectsNode(const R3TriangleBVHNode& node, const RNCoord origin[3], const RNScalar inverse[3],
+  const int sign[3], RNScalar max_t, RNScalar& entry_t)
+{
+  // Intersect ray with slabs of node box
+  RNScalar tmin = (node.box[sign[0]][0] - origin[0]) * inverse[0];
+  RNScalar tmax = (node.box[1-sign[0]][0] - origin[0]) * inverse[0];
+  RNScalar t0 = (node.box[sign[1]][1] - origin[1]) * inverse[1];
+  RNScalar t1 = (node.box[1-sign[1]][1] - origin[1]) * inverse[1];
+  if (t0 > tmin) tmin = t0;
+  if (t1 < tmax) tmax = t1;
+  t0 = (node.box[sign[2]][2] - origin[2]) * inverse[2];
+  t1 = (node.box[1-sign[2]][2] - origin[2]) * inverse[2];
+  if (t0 > tmin) tmin = t0;
+  if (t1 < tmax) tmax = t1;
+
+  // Check whether interval overlaps [0, max_t]
+  if (tmin < 0) tmin = 0;
+  if (tmax < tmin) return FALSE;
+  if (tmin > max_t) return FALSE;
+  entry_t = tmin;
+  return TRUE;
+}
+
+
+
+RNClassID R3TriangleBVH::
+FindIntersection(const R3Ray& ray, R3Point *hit_point, R3Vector *hit_normal, RNScalar *hit_t,
+  R3Triangle **hit_triangle) const
+{
+  // Initialize result
+  RNClassID status = RN_NULL_CLASS_ID;
+  RNScalar min_t = FLT_MAX;
+  if (hit_t) *hit_t = min_t;
+  if (nnodes == 0) return status;
+
+  // Precompute ray data for triangle tests
+  R3TriangleRay triangle_ray(ray);
+
+  // Precompute ray data for slab tests (zero components never cross a slab)
+  RNCoord origin[3];
+  RNScalar inverse[3];
+  int sign[3];
+  for (int dim = RN_X; dim <= RN_Z; dim++) {
+    origin[dim] = ray.Start()[dim];
+    RNScalar d = ray.Vector()[dim];
+    inverse[dim] = (d != 0) ? 1.0 / d : 1.0E30;
+    sign[dim] = (inverse[dim] < 0) ? 1 : 0;
+  }
+
+  // Check root
+  R3Triangle *closest_triangle = NULL;
+  RNScalar entry_t;
+  if (!IntersectsNode(nodes[0], origin, inverse, sign, min_t, entry_t)) return status;
+
+  // Traverse nodes front-to-back
+  struct { int index; RNScalar t; } stack[R3bvh_max_depth + 4];
+  int nstack = 0;
+  stack[nstack].index = 0;
+  stack[nstack].t = entry_t;
+  nstack++;
+  while (nstack > 0) {
+    // Pop node, skipping it if it starts beyond closest hit
+    nstack--;
+    if (stack[nstack].t > min_t) continue;
+    const R3TriangleBVHNode& node = nodes[stack[nstack].index];
+
+    // Check packets of triangles in leaf
+    if (node.ntriangles > 0) {
+      int npackets = (node.ntriangles + R3_TRIANGLE_PACKET_SIZE - 1) / R3_TRIANGLE_PACKET_SIZE;
+      for (int i = node.index; i < node.index + npackets; i++) {
+        int lane = triangle_ray.Intersects(packets[i], min_t, &min_t);
+        if (lane >= 0) {
+          closest_triangle = packet_triangles[i * R3_TRIANGLE_PACKET_SIZE + lane];
+        }
+      }
+      continue;
+    }
+
+    // Push children so that the nearer one is visited first
+    int child0 = stack[nstack].index + 1;
+    int child1 = node.index;
+    RNScalar t0, t1;
+    RNBoolean hit0 = IntersectsNode(nodes[child0], origin, inverse, sign, min_t, t0);
+    RNBoolean hit1 = IntersectsNode(nodes[child1], origin, inverse, sign, min_t, t1);
+    if (hit0 && hit1) {
+      if (t1 < t0) {
+        stack[nstack].index = child0; stack[nstack].t = t0; nstack++;
+        stack[nstack].index = child1; stack[nstack].t = t1; nstack++;
+      }
+      else {
+        stack[nstack].index = child1; stack[nstack].t = t1; nstack++;
+        stack[nstack].index = child0; stack[nstack].t = t0; nstack++;
+      }
+    }
+    else if (hit0) {
+      stack[nstack].index = child0; stack[nstack].t = t0; nstack++;
+    }
+    else if (hit1) {
+      stack[nstack].index = child1; stack[nstack].t = t1; nstack++;
+    }
+  }
+
+  // Update hit t
+  if (hit_t) *hit_t = min_t;
+  if (!closest_triangle) return status;
+
+  // Return hit on closest triangle
+  if (hit_point) *hit_point = ray.Point(min_t);
+  if (hit_normal) *hit_normal = closest_triangle->Normal();
+  if (hit_triangle) *hit_triangle = closest_triangle;
+  status = R3_POINT_CLASS_ID;
+  return status;
+}
+
+
+
+RNBoolean R3TriangleBVH::
+FindAnyIntersection(const R3Ray& ray, RNScalar max_t) const
+{
+  // Check tree
+  if (nnodes == 0) return FALSE;
+
+  // Precompute ray data for triangle and slab tests
+  R3TriangleRay triangle_ray(ray);
+  RNCoord origin[3];
+  RNScalar inverse[3];
+  int sign[3];
+  for (int dim = RN_X; dim <= RN_Z; dim++) {
+    origin[dim] = ray.Start()[dim];
+    RNScalar d = ray.Vector()[dim];
+    inverse[dim] = (d != 0) ? 1.0 / d : 1.0E30;
+    sign[dim] = (inverse[dim] < 0) ? 1 : 0;
+  }
+
+  // Traverse nodes until first hit (order does not matter)
+  int stack[R3bvh_max_depth + 4];
+  int nstack = 0;
+  stack[nstack++] = 0;
+  while (nstack > 0) {
+    int index = stack[--nstack];
+    const R3TriangleBVHNode& node = nodes[index];
+    RNScalar entry_t;
+    if (!IntersectsNode(node, origin, inverse, sign, max_t, entry_t)) continue;
+
+    // Check packets of triangles in leaf
+    if (node.ntriangles > 0) {
+      int npackets = (node.ntriangles + R3_TRIANGLE_PACKET_SIZE - 1) / R3_TRIANGLE_PACKET_SIZE;
+      for (int i = node.index; i < node.index + npackets; i++) {
+        if (triangle_ray.Intersects(packets[i], max_t, NULL) >= 0) return TRUE;
+      }
+      continue;
+    }
+
+    // Push children
+    stack[nstack++] = node.index;
+    stack[nstack++] = index + 1;
+  }
+
+  // No triangle hit
+  return FALSE;
+}
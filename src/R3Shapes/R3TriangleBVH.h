@@ -0,0 +1,95 @@
+// Include file for triangle bounding volume hierarchy class
+
+
+
+// Node declaration
+
+struct R3TriangleBVHNode;
+
+
+
+// Class declaration
+
+// Triangles of an array are sorted into a binary tree of bounding boxes built
+// with the surface area heuristic.  Nodes are stored depth-first in one array:
+// the first child of an interior node follows it directly and the second child
+// is found by index, so rays are traversed front-to-back with a small stack.
+// Leaves copy the vertices of their triangles into packets that are tested
+// with one watertight batch intersection each.
+
+class R3TriangleBVH {
+public:
+  // Constructor/destructors
+  R3TriangleBVH(const R3TriangleArray& array);
+  ~R3TriangleBVH(void);
+
+  // Property functions
+  const R3Box& BBox(void) const;
+  int NNodes(void) const;
+  int NTriangles(void) const;
+  int NPackets(void) const;
+
+  // Find first ray intersection
+  RNClassID FindIntersection(const R3Ray& ray,
+    R3Point *hit_point = NULL, R3Vector *hit_normal = NULL, RNScalar *hit_t = NULL,
+    R3Triangle **hit_triangle = NULL) const;
+
+  // Check for any ray intersection with 0 <= t < max_t
+  RNBoolean FindAnyIntersection(const R3Ray& ray, RNScalar max_t) const;
+
+public:
+  // Internal build functions
+  int Build(int first, int ntriangles, R3Box *triangle_boxes, R3Point *centroids, int depth);
+  void BuildPackets(void);
+
+  // Maximum number of triangles in a leaf (one packet)
+  static const int max_leaf_triangles = R3_TRIANGLE_PACKET_SIZE;
+
+  // Internal data
+  R3Triangle **triangles;
+  int ntriangles;
+  R3TrianglePacket *packets;
+  R3Triangle **packet_triangles;
+  int npackets;
+  R3TriangleBVHNode *nodes;
+  int nnodes;
+  R3Box bbox;
+};
+
+
+
+// Inline functions
+
+inline const R3Box& R3TriangleBVH::
+BBox(void) const
+{
+  // Return bounding box
+  return bbox;
+}
+
+
+
+inline int R3TriangleBVH::
+NNodes(void) const
+{
+  // Return number of nodes
+  return nnodes;
+}
+
+
+
+inline int R3TriangleBVH::
+NTriangles(void) const
+{
+  // Return number of triangles
+  return ntriangles;
+}
+
+
+
+inline int R3TriangleBVH::
+NPackets(void) const
+{
+  // Return number of triangle packets
+  return npackets;
+}
@@ -0,0 +1,61 @@
+/* Source file for the R3 watertight ray/triangle intersection classes */
+
+
+
+/* Include files */
+
+#include "R3Shapes/R3Shapes.h"
+
+
+
+/* Packet functions */
+
+void R3TrianglePacket::
+SetTriangle(int lane, const R3Point& p0, const R3Point& p1, const R3Point& p2)
+{
+    // Copy vertex coordinates into lane
+    for (int dim = RN_X; dim <= RN_Z; dim++) {
+        v[0][dim][lane] = p0[dim];
+        v[1][dim][lane] = p1[dim];
+        v[2][dim][lane] = p2[dim];
+    }
+}
+
+
+
+void R3TrianglePacket::
+SetEmpty(int lane)
+{
+    // Fill lane with degenerate triangle (all edge functions are zero)
+    for (int dim = RN_X; dim <= RN_Z; dim++) {
+        v[0][dim][lane] = 0;
+        v[1][dim][lane] = 0;
+        v[2][dim][lane] = 0;
+    }
+}
+
+
+
+/* Ray member functions */
+
+R3TriangleRay::
+R3TriangleRay(const R3Ray& ray)
+{
+    // Copy origin
+    const R3Point& start = ray.Start();
+    origin[0] = start.X();
+    origin[1] = start.Y();
+    origin[2] = start.Z();
+
+    // Choose largest dimension of direction as z and keep winding
+    const R3Vector& vector = ray.Vector();
+    kz = vector.MaxDimension();
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    if (vector[kz] < 0) { int swap = kx; kx = ky; ky = swap; }
+
+    // Compute shear constants
+    sx = vector[kx] / vector[kz];
+    sy = vector[ky] / vector[kz];
+    sz = 1.0 / vector[kz];
+}
@@ -0,0 +1,131 @@
+/* Include file for the R3 watertight ray/triangle intersection classes */
+
+
+
+/* Packet definition */
+
+// Number of triangles tested at once by R3TriangleRay::Intersects(packet)
+#define R3_TRIANGLE_PACKET_SIZE 4
+
+// Vertex coordinates of several triangles in structure-of-arrays layout, so that
+// one loop over the lanes can be vectorized.  Unused lanes hold degenerate
+// triangles, which are never hit.
+
+struct R3TrianglePacket {
+    // Manipulation functions
+    void SetTriangle(int lane, const R3Point& p0, const R3Point& p1, const R3Point& p2);
+    void SetEmpty(int lane);
+
+    // Coordinates indexed by vertex, dimension, and lane
+    RNCoord v[3][3][R3_TRIANGLE_PACKET_SIZE];
+};
+
+
+
+/* Class definition */
+
+// Ray data precomputed for the watertight intersection test of Woop, Benthin,
+// and Wald (JCGT 2013).  Triangles are sheared into a space where the ray is
+// the +z axis, and hits are decided by signed edge functions evaluated
+// identically for the two triangles sharing an edge, so rays cannot slip
+// through edges or vertices of a closed mesh.
+
+class R3TriangleRay {
+    public:
+        // Constructor functions
+        R3TriangleRay(const R3Ray& ray);
+
+        // Intersection functions (hits with 0 <= t < max_t)
+        RNBoolean Intersects(const R3Point& p0, const R3Point& p1, const R3Point& p2,
+            RNScalar max_t, RNScalar *hit_t) const;
+        int Intersects(const R3TrianglePacket& packet, RNScalar max_t, RNScalar *hit_t) const;
+
+    private:
+        RNCoord origin[3];
+        int kx, ky, kz;
+        RNScalar sx, sy, sz;
+};
+
+
+
+/* Inline functions */
+
+inline RNBoolean R3TriangleRay::
+Intersects(const R3Point& p0, const R3Point& p1, const R3Point& p2, RNScalar max_t, RNScalar *hit_t) const
+{
+    // Translate vertices to ray origin
+    RNCoord ax = p0[kx] - origin[kx], ay = p0[ky] - origin[ky], az = p0[kz] - origin[kz];
+    RNCoord bx = p1[kx] - origin[kx], by = p1[ky] - origin[ky], bz = p1[kz] - origin[kz];
+    RNCoord cx = p2[kx] - origin[kx], cy = p2[ky] - origin[ky], cz = p2[kz] - origin[kz];
+
+    // Shear so that ray is along +z
+    ax -= sx * az; ay -= sy * az;
+    bx -= sx * bz; by -= sy * bz;
+    cx -= sx * cz; cy -= sy * cz;
+
+    // Compute scaled barycentric coordinates (edge functions)
+    RNScalar u = cx * by - cy * bx;
+    RNScalar v = ax * cy - ay * cx;
+    RNScalar w = bx * ay - by * ax;
+    if (((u < 0) || (v < 0) || (w < 0)) && ((u > 0) || (v > 0) || (w > 0))) return FALSE;
+
+    // Check for ray parallel to triangle plane
+    RNScalar det = u + v + w;
+    if (det == 0) return FALSE;
+
+    // Compute scaled distance and check interval
+    RNScalar t = u * (sz * az) + v * (sz * bz) + w * (sz * cz);
+    if (det < 0) { t = -t; det = -det; }
+    if ((t < 0) || (t >= max_t * det)) return FALSE;
+
+    // Return hit
+    if (hit_t) *hit_t = t / det;
+    return TRUE;
+}
+
+
+
+inline int R3TriangleRay::
+Intersects(const R3TrianglePacket& packet, RNScalar max_t, RNScalar *hit_t) const
+{
+    // Get coordinates of all lanes along sheared axes
+    const RNCoord *ax = packet.v[0][kx], *ay = packet.v[0][ky], *az = packet.v[0][kz];
+    const RNCoord *bx = packet.v[1][kx], *by = packet.v[1][ky], *bz = packet.v[1][kz];
+    const RNCoord *cx = packet.v[2][kx], *cy = packet.v[2][ky], *cz = packet.v[2][kz];
+    RNCoord ox = origin[kx], oy = origin[ky], oz = origin[kz];
+
+    // Evaluate all lanes without branches
+    RNScalar lane_t[R3_TRIANGLE_PACKET_SIZE];
+    int lane_hit[R3_TRIANGLE_PACKET_SIZE];
+    for (int i = 0; i < R3_TRIANGLE_PACKET_SIZE; i++) {
+        RNCoord az0 = az[i] - oz, bz0 = bz[i] - oz, cz0 = cz[i] - oz;
+        RNCoord ax0 = (ax[i] - ox) - sx * az0, ay0 = (ay[i] - oy) - sy * az0;
+        RNCoord bx0 = (bx[i] - ox) - sx * bz0, by0 = (by[i] - oy) - sy * bz0;
+        RNCoord cx0 = (cx[i] - ox) - sx * cz0, cy0 = (cy[i] - oy) - sy * cz0;
+        RNScalar u = cx0 * by0 - cy0 * bx0;
+        RNScalar v = ax0 * cy0 - ay0 * cx0;
+        RNScalar w = bx0 * ay0 - by0 * ax0;
+        RNScalar det = u + v + w;
+        RNScalar t = u * (sz * az0) + v * (sz * bz0) + w * (sz * cz0);
+        RNScalar sign = (det < 0) ? -1.0 : 1.0;
+        t *= sign;
+        det *= sign;
+        int negative = (u < 0) | (v < 0) | (w < 0);
+        int positive = (u > 0) | (v > 0) | (w > 0);
+        lane_hit[i] = !(negative & positive) & (det != 0) & (t >= 0) & (t < max_t * det);
+        lane_t[i] = t / ((det != 0) ? det : 1.0);
+    }
+
+    // Find closest lane hit
+    int closest_lane = -1;
+    for (int i = 0; i < R3_TRIANGLE_PACKET_SIZE; i++) {
+        if (lane_hit[i] && (lane_t[i] < max_t)) {
+            closest_lane = i;
+            max_t = lane_t[i];
+        }
+    }
+
+    // Return closest lane (or -1 if no hit)
+    if ((closest_lane >= 0) && hit_t) *hit_t = max_t;
+    return closest_lane;
+}
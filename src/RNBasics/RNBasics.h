@@ -56,6 +56,7 @@
 /* Math include files */
 
 #include "RNScalar.h"
+#include "RNRandom.h"
 #include "RNIntval.h"
 
 
@@ -78,6 +79,7 @@
 /* OS utility include files */
 
 #include "RNTime.h"
+#include "RNThreads.h"
 
 
 
@@ -0,0 +1,275 @@
+/* Source file for GAPS counter-based random number generator class */
+
+
+
+/* Include files */
+
+#include "RNBasics.h"
+
+
+
+/* Private constants */
+
+// Philox4x32 multipliers and Weyl sequence key increments (Salmon et al. 2011)
+static const unsigned int RNphilox_m0 = 0xD2511F53;
+static const unsigned int RNphilox_m1 = 0xCD9E8D57;
+static const unsigned int RNphilox_w0 = 0x9E3779B9;
+static const unsigned int RNphilox_w1 = 0xBB67AE85;
+static const int RNphilox_rounds = 10;
+
+// Block index that is never cached
+static const unsigned int RNphilox_no_block = 0xFFFFFFFF;
+
+// Halton bases of low dimensions
+static const unsigned int RNhalton_bases[RN_MAX_LOW_DISCREPANCY_DIMENSIONS] = {
+  2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71, 73, 79, 83, 89
+};
+
+// Degree, inner coefficients of primitive polynomial, and initial direction numbers
+// of Sobol dimensions after the first (Joe and Kuo 2008)
+static const struct { int degree; unsigned int a; unsigned int m[7]; } RNsobol_polynomials[RN_MAX_LOW_DISCREPANCY_DIMENSIONS - 1] = {
+  { 1,  0, {   1,   0,   0,   0,   0,   0,   0 } },
+  { 2,  1, {   1,   3,   0,   0,   0,   0,   0 } },
+  { 3,  1, {   1,   3,   1,   0,   0,   0,   0 } },
+  { 3,  2, {   1,   1,   1,   0,   0,   0,   0 } },
+  { 4,  1, {   1,   1,   3,   3,   0,   0,   0 } },
+  { 4,  4, {   1,   3,   5,  13,   0,   0,   0 } },
+  { 5,  2, {   1,   1,   5,   5,  17,   0,   0 } },
+  { 5,  4, {   1,   1,   5,   5,   5,   0,   0 } },
+  { 5,  7, {   1,   1,   7,  11,  19,   0,   0 } },
+  { 5, 11, {   1,   1,   5,   1,   1,   0,   0 } },
+  { 5, 13, {   1,   1,   1,   3,  11,   0,   0 } },
+  { 5, 14, {   1,   3,   5,   5,  31,   0,   0 } },
+  { 6,  1, {   1,   3,   3,   9,   7,  49,   0 } },
+  { 6, 13, {   1,   1,   1,  15,  21,  21,   0 } },
+  { 6, 16, {   1,   3,   1,  13,  27,  49,   0 } },
+  { 6, 19, {   1,   1,   1,  15,   7,   5,   0 } },
+  { 6, 22, {   1,   3,   1,  15,  13,  25,   0 } },
+  { 6, 25, {   1,   1,   5,   5,  19,  61,   0 } },
+  { 7,  1, {   1,   3,   7,  11,  23,  15, 103 } },
+  { 7,  4, {   1,   3,   7,  13,  13,  15,  69 } },
+  { 7,  7, {   1,   1,   3,  13,   7,  35,  63 } },
+  { 7,  8, {   1,   3,   5,   9,   1,  25,  53 } },
+  { 7, 14, {   1,   3,   1,  13,   9,  35, 107 } },
+};
+
+
+
+/* Private variables */
+
+static int RNrandom_sequence = RN_PHILOX_SEQUENCE;
+static unsigned int RNsobol_directions[RN_MAX_LOW_DISCREPANCY_DIMENSIONS][32];
+
+
+
+/* Private functions */
+
+static int
+RNInitSobolDirections(void)
+{
+  // First dimension is van der Corput sequence
+  for (int k = 0; k < 32; k++) RNsobol_directions[0][k] = 1U << (31 - k);
+
+  // Other dimensions follow recurrence of their polynomial
+  for (int d = 1; d < RN_MAX_LOW_DISCREPANCY_DIMENSIONS; d++) {
+    int s = RNsobol_polynomials[d-1].degree;
+    unsigned int a = RNsobol_polynomials[d-1].a;
+    unsigned int *v = RNsobol_directions[d];
+    for (int k = 0; k < 32; k++) {
+      if (k < s) { v[k] = RNsobol_polynomials[d-1].m[k] << (31 - k); continue; }
+      v[k] = v[k-s] ^ (v[k-s] >> s);
+      for (int j = 1; j < s; j++) {
+        if ((a >> (s - 1 - j)) & 1) v[k] ^= v[k-j];
+      }
+    }
+  }
+  return 1;
+}
+
+// Direction numbers are computed when the library is loaded, before any threads start
+static int RNsobol_directions_ready = RNInitSobolDirections();
+
+
+
+static unsigned int
+RNHash32(unsigned int x)
+{
+  // Return well mixed 32 bits (lowbias32 of Wellons)
+  x ^= x >> 16; x *= 0x7FEB352D;
+  x ^= x >> 15; x *= 0x846CA68B;
+  x ^= x >> 16;
+  return x;
+}
+
+
+
+static unsigned int
+RNReverseBits(unsigned int x)
+{
+  // Return bits of x in reverse order
+  x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+  x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+  x = ((x >> 4) & 0x0F0F0F0F) | ((x & 0x0F0F0F0F) << 4);
+  x = ((x >> 8) & 0x00FF00FF) | ((x & 0x00FF00FF) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+
+
+static unsigned int
+RNOwenScramble(unsigned int x, unsigned int seed)
+{
+  // Return nested uniform scramble of binary digits of x (Burley 2020)
+  x = RNReverseBits(x);
+  x += seed;
+  x ^= x * 0x6C50B47C;
+  x ^= x * 0xB82F1E52;
+  x ^= x * 0xC7AFE638;
+  x ^= x * 0x8D22F6E6;
+  return RNReverseBits(x);
+}
+
+
+
+void
+RNSetRandomSequence(int sequence)
+{
+  // Set sequence of generators constructed without one
+  RNrandom_sequence = sequence;
+}
+
+
+
+int
+RNRandomSequence(void)
+{
+  // Return sequence of generators constructed without one
+  return RNrandom_sequence;
+}
+
+
+
+RNRandomGenerator::
+RNRandomGenerator(unsigned long long seed, unsigned long long index, int sequence)
+  : index(index),
+    dimension(0),
+    sequence(sequence),
+    block_index(RNphilox_no_block)
+{
+  // Set key
+  key[0] = (unsigned int) (seed & 0xFFFFFFFFULL);
+  key[1] = (unsigned int) (seed >> 32);
+}
+
+
+
+void RNRandomGenerator::
+SetSeed(unsigned long long seed)
+{
+  // Set key and forget cached block
+  key[0] = (unsigned int) (seed & 0xFFFFFFFFULL);
+  key[1] = (unsigned int) (seed >> 32);
+  block_index = RNphilox_no_block;
+}
+
+
+
+void RNRandomGenerator::
+SetIndex(unsigned long long index, unsigned int dimension)
+{
+  // Set counter and forget cached block
+  this->index = index;
+  this->dimension = dimension;
+  block_index = RNphilox_no_block;
+}
+
+
+
+unsigned int RNRandomGenerator::
+Integer(unsigned int dimension) const
+{
+  // Use low discrepancy sequence for low dimensions
+  if ((sequence != RN_PHILOX_SEQUENCE) && (dimension < RN_MAX_LOW_DISCREPANCY_DIMENSIONS)) {
+    return LowDiscrepancyInteger(dimension);
+  }
+
+  // Use cached block if possible
+  unsigned int b = dimension >> 2;
+  if (b == block_index) return block[dimension & 3];
+
+  // Compute block containing dimension
+  unsigned int result[4];
+  ComputeBlock(b, result);
+  return result[dimension & 3];
+}
+
+
+
+void RNRandomGenerator::
+ComputeBlock(unsigned int block_index, unsigned int block[4]) const
+{
+  // Counter is (index, block of dimensions)
+  unsigned int c0 = (unsigned int) (index & 0xFFFFFFFFULL);
+  unsigned int c1 = (unsigned int) (index >> 32);
+  unsigned int c2 = block_index;
+  unsigned int c3 = 0;
+  unsigned int k0 = key[0];
+  unsigned int k1 = key[1];
+
+  // Apply Philox rounds
+  for (int i = 0; i < RNphilox_rounds; i++) {
+    unsigned long long p0 = (unsigned long long) RNphilox_m0 * c0;
+    unsigned long long p1 = (unsigned long long) RNphilox_m1 * c2;
+    unsigned int hi0 = (unsigned int) (p0 >> 32), lo0 = (unsigned int) p0;
+    unsigned int hi1 = (unsigned int) (p1 >> 32), lo1 = (unsigned int) p1;
+    c0 = hi1 ^ c1 ^ k0;
+    c1 = lo1;
+    c2 = hi0 ^ c3 ^ k1;
+    c3 = lo0;
+    k0 += RNphilox_w0;
+    k1 += RNphilox_w1;
+  }
+
+  // Return block
+  block[0] = c0;
+  block[1] = c1;
+  block[2] = c2;
+  block[3] = c3;
+}
+
+
+
+unsigned int RNRandomGenerator::
+LowDiscrepancyInteger(unsigned int dimension) const
+{
+  // Scramble differs by seed, stream (high bits of index) and dimension
+  unsigned int point = (unsigned int) (index & 0xFFFFFFFFULL);
+  unsigned int scramble = RNHash32(key[0] ^ RNHash32(key[1] ^ RNHash32((unsigned int) (index >> 32) ^ RNHash32(dimension))));
+
+  if (sequence == RN_SOBOL_SEQUENCE) {
+    // Owen scrambled Sobol point
+    unsigned int x = 0;
+    const unsigned int *v = RNsobol_directions[dimension];
+    for (int k = 0; point; point >>= 1, k++) {
+      if (point & 1) x ^= v[k];
+    }
+    return RNOwenScramble(x, scramble);
+  }
+  else {
+    // Radical inverse with random linear permutation of digits at every level (Matousek 1998)
+    unsigned int base = RNhalton_bases[dimension];
+    double inverse_base = 1.0 / base;
+    double factor = inverse_base;
+    double value = 0;
+    for (int level = 0; factor > 1.0 / 4294967296.0; level++) {
+      unsigned int h = RNHash32(scramble + level * 0x9E3779B9);
+      unsigned int a = (base > 2) ? 1 + h % (base - 1) : 1;
+      unsigned int c = (h >> 16) % base;
+      value += ((a * (point % base) + c) % base) * factor;
+      point /= base;
+      factor *= inverse_base;
+    }
+    double x = value * 4294967296.0;
+    return (x < 4294967295.0) ? (unsigned int) x : 0xFFFFFFFF;
+  }
+}
@@ -0,0 +1,156 @@
+/* Include file for GAPS counter-based random number generator class */
+
+
+
+/* Class definition */
+
+// Random numbers are computed as a pure function of (seed, index, dimension) with
+// the Philox4x32-10 block cipher, so a sample does not depend on which thread
+// draws it or in what order.  Typically index is the number of a photon or pixel
+// and dimension counts the random numbers drawn for it so far.
+//
+// The first RN_MAX_LOW_DISCREPANCY_DIMENSIONS dimensions can instead come from
+// a scrambled Halton or Sobol sequence, whose point number is the low 32 bits
+// of index.  The high bits of index (the stream) and the seed select the
+// scramble, so separate streams stay independent.  Later dimensions are
+// always drawn with Philox.
+
+#define RN_PHILOX_SEQUENCE 0
+#define RN_HALTON_SEQUENCE 1
+#define RN_SOBOL_SEQUENCE 2
+
+#define RN_MAX_LOW_DISCREPANCY_DIMENSIONS 24
+
+// Sequence of generators constructed without one
+extern void RNSetRandomSequence(int sequence);
+extern int RNRandomSequence(void);
+
+class RNRandomGenerator /* : public RNBase */ {
+    public:
+        // Constructor functions
+        RNRandomGenerator(unsigned long long seed = 0, unsigned long long index = 0, int sequence = RNRandomSequence());
+
+        // Property functions
+        unsigned long long Seed(void) const;
+        unsigned long long Index(void) const;
+        unsigned int Dimension(void) const;
+        int Sequence(void) const;
+
+        // Manipulation functions
+        void SetSeed(unsigned long long seed);
+        void SetIndex(unsigned long long index, unsigned int dimension = 0);
+        void SetDimension(unsigned int dimension);
+        void SetSequence(int sequence);
+
+        // Sampling functions (return next dimension)
+        unsigned int Integer(void);
+        RNScalar Scalar(void);
+
+        // Sampling functions (random access, do not advance)
+        unsigned int Integer(unsigned int dimension) const;
+        RNScalar Scalar(unsigned int dimension) const;
+
+    private:
+        void ComputeBlock(unsigned int block_index, unsigned int block[4]) const;
+        unsigned int LowDiscrepancyInteger(unsigned int dimension) const;
+
+    private:
+        unsigned int key[2];
+        unsigned long long index;
+        unsigned int dimension;
+        int sequence;
+        unsigned int block_index;
+        unsigned int block[4];
+};
+
+
+
+/* Inline functions */
+
+inline unsigned long long RNRandomGenerator::
+Seed(void) const
+{
+    // Return seed (key of block cipher)
+    return ((unsigned long long) key[1] << 32) | key[0];
+}
+
+
+
+inline unsigned long long RNRandomGenerator::
+Index(void) const
+{
+    // Return index of sample
+    return index;
+}
+
+
+
+inline unsigned int RNRandomGenerator::
+Dimension(void) const
+{
+    // Return dimension of next random number
+    return dimension;
+}
+
+
+
+inline int RNRandomGenerator::
+Sequence(void) const
+{
+    // Return sequence of low dimensions
+    return sequence;
+}
+
+
+
+inline void RNRandomGenerator::
+SetDimension(unsigned int dimension)
+{
+    // Set dimension of next random number
+    this->dimension = dimension;
+}
+
+
+
+inline void RNRandomGenerator::
+SetSequence(int sequence)
+{
+    // Set sequence of low dimensions
+    this->sequence = sequence;
+}
+
+
+
+inline unsigned int RNRandomGenerator::
+Integer(void)
+{
+    // Use low discrepancy sequence for low dimensions
+    if ((sequence != RN_PHILOX_SEQUENCE) && (dimension < RN_MAX_LOW_DISCREPANCY_DIMENSIONS)) {
+        return LowDiscrepancyInteger(dimension++);
+    }
+
+    // Compute block of four random numbers if not cached
+    unsigned int b = dimension >> 2;
+    if (b != block_index) { ComputeBlock(b, block); block_index = b; }
+
+    // Return next random number from block
+    return block[dimension++ & 3];
+}
+
+
+
+inline RNScalar RNRandomGenerator::
+Scalar(void)
+{
+    // Return random number in [0,1)
+    return (RNScalar) Integer() * (RNScalar) (1.0 / 4294967296.0);
+}
+
+
+
+inline RNScalar RNRandomGenerator::
+Scalar(unsigned int dimension) const
+{
+    // Return random number in [0,1) for given dimension
+    return (RNScalar) Integer(dimension) * (RNScalar) (1.0 / 4294967296.0);
+}
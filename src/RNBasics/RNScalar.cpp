@@ -5,6 +5,7 @@
 /* Include files */
 
 #include "RNBasics/RNBasics.h"
+#include <atomic>
 
 
 
@@ -41,6 +42,10 @@ const RNScalar RN_SQRT_THREE = 1.7320508;
 /* Private variables */
 
 static RNBoolean random_seeded = FALSE;
+static unsigned long long random_seed = 0;
+static std::atomic<unsigned long long> random_nthreads(0);
+static thread_local RNRandomGenerator random_generator(0, 0, RN_PHILOX_SEQUENCE); // independent draws, never low discrepancy
+static thread_local RNBoolean random_generator_seeded = FALSE;
 
 
 
@@ -96,23 +101,59 @@ RNSetEpsilon(RNScalar epsilon)
 
 /* Random number functions */
 
+// Each thread draws from its own counter-based generator (see RNRandom.h), so
+// RNRandomScalar can be called from several threads at once.  Threads that do
+// not choose a stream get a distinct one in the order they first draw a number.
+
+static const unsigned long long random_thread_stream = 1ULL << 63;
+
+
+
 void 
 RNSeedRandomScalar(RNScalar seed)
 {
+  // Compute seed from time if none is given
+  long value;
+  if (seed == 0.0) { 
 #if (RN_OS == RN_WINDOWS)
-  if (seed == 0.0) srand(GetTickCount());
-  else srand((int) (1.0E6 * seed));
+    value = (long) GetTickCount();
 #else
-  if (seed == 0.0) { 
-      struct timeval timevalue;
-      gettimeofday(&timevalue, NULL);
-      srand48(timevalue.tv_usec);
+    struct timeval timevalue;
+    gettimeofday(&timevalue, NULL);
+    value = timevalue.tv_usec;
+#endif
   }
   else {
-    srand48((long) (1.0E6 * seed));
+    value = (long) (1.0E6 * seed);
   }
-#endif
+  random_seed = ((unsigned long long) value) & 0xFFFFFFFFULL;
   random_seeded = TRUE;
+
+  // Seed the calling thread
+  random_generator.SetSeed(random_seed);
+  random_generator.SetIndex(0);
+  random_generator_seeded = TRUE;
+}
+
+
+
+unsigned long long
+RNRandomScalarSeed(void)
+{
+  // Return seed shared by all threads
+  if (!random_seeded) RNSeedRandomScalar();
+  return random_seed;
+}
+
+
+
+void 
+RNSeedRandomScalarStream(unsigned long long stream)
+{
+  // Seed the calling thread with a sequence determined only by the seed and stream
+  random_generator.SetSeed(RNRandomScalarSeed());
+  random_generator.SetIndex(stream);
+  random_generator_seeded = TRUE;
 }
 
 
@@ -120,14 +161,19 @@ RNSeedRandomScalar(RNScalar seed)
 RNScalar
 RNRandomScalar(void)
 {
-    if (!random_seeded) RNSeedRandomScalar();
-#   if (RN_OS == RN_WINDOWS)
-    int r1 = rand();
-    RNScalar r2 = ((RNScalar) rand()) / ((RNScalar) (RAND_MAX + 1));
-    return (r1 + r2) / ((RNScalar) (RAND_MAX + 1));
-#else
-    return drand48();
-#   endif
+    // Seed generator for this thread
+    if (!random_generator_seeded) {
+      unsigned long long thread_count = random_nthreads++;
+      RNSeedRandomScalarStream(random_thread_stream + (thread_count << 32));
+    }
+
+    // Move on to next stream when dimensions run out
+    if (random_generator.Dimension() == 0xFFFFFFFF) {
+      random_generator.SetIndex(random_generator.Index() + 1);
+    }
+
+    // Return next random number
+    return random_generator.Scalar();
 }
 
 
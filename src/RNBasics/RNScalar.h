@@ -173,6 +173,8 @@ extern void RNSetEpsilon(RNScalar epsilon);
 /* Random number generator */
 
 extern void RNSeedRandomScalar(RNScalar seed = 0.0);
+extern unsigned long long RNRandomScalarSeed(void);
+extern void RNSeedRandomScalarStream(unsigned long long stream);
 extern RNScalar RNRandomScalar(void);
 
 
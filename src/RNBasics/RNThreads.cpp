@@ -0,0 +1,143 @@
+/* Source file for GAPS thread utility functions */
+
+
+
+/* Include files */
+
+#include "RNBasics.h"
+#include <thread>
+#include <mutex>
+#include <vector>
+
+
+
+/* Private variables */
+
+static int RNnum_threads = 0;
+
+
+
+int
+RNNumThreads(void)
+{
+  // Return number of threads set by user or number of hardware threads
+  if (RNnum_threads > 0) return RNnum_threads;
+  int nthreads = (int) std::thread::hardware_concurrency();
+  return (nthreads > 0) ? nthreads : 1;
+}
+
+
+
+void
+RNSetNumThreads(int nthreads)
+{
+  // Set number of threads (zero means number of hardware threads)
+  RNnum_threads = (nthreads > 0) ? nthreads : 0;
+}
+
+
+
+/* Work-stealing parallel loop */
+
+struct RNTaskRange {
+  std::mutex mutex;
+  int next;
+  int end;
+};
+
+
+
+static void
+RNRunTasks(std::vector<RNTaskRange>& ranges, int thread_index,
+  void (*callback)(int, int, void *), void *data)
+{
+  // Get range owned by this thread
+  RNTaskRange& own = ranges[thread_index];
+  int nranges = (int) ranges.size();
+
+  while (TRUE) {
+    // Take next task from own range
+    int task = -1;
+    own.mutex.lock();
+    if (own.next < own.end) task = own.next++;
+    own.mutex.unlock();
+
+    // Steal upper half of largest remaining range of another thread
+    if (task < 0) {
+      int victim = -1;
+      int victim_size = 0;
+      for (int i = 1; i < nranges; i++) {
+        int k = (thread_index + i) % nranges;
+        ranges[k].mutex.lock();
+        int size = ranges[k].end - ranges[k].next;
+        ranges[k].mutex.unlock();
+        if (size > victim_size) { victim = k; victim_size = size; }
+      }
+
+      // Check if all tasks have been taken
+      if (victim < 0) return;
+
+      // Split victim range
+      int steal_start = 0, steal_end = 0;
+      ranges[victim].mutex.lock();
+      int size = ranges[victim].end - ranges[victim].next;
+      if (size > 0) {
+        steal_end = ranges[victim].end;
+        steal_start = ranges[victim].next + size / 2;
+        ranges[victim].end = steal_start;
+      }
+      ranges[victim].mutex.unlock();
+      if (steal_start == steal_end) continue;
+
+      // Make stolen range our own
+      own.mutex.lock();
+      own.next = steal_start + 1;
+      own.end = steal_end;
+      own.mutex.unlock();
+      task = steal_start;
+    }
+
+    // Execute task
+    (*callback)(task, thread_index, data);
+  }
+}
+
+
+
+void
+RNParallelFor(int ntasks, void (*callback)(int, int, void *), void *data, int nthreads)
+{
+  // Check number of tasks
+  if (ntasks <= 0) return;
+
+  // Determine number of threads
+  if (nthreads <= 0) nthreads = RNNumThreads();
+  if (nthreads > ntasks) nthreads = ntasks;
+
+  // Run serially on this thread if only one thread
+  if (nthreads == 1) {
+    for (int i = 0; i < ntasks; i++) (*callback)(i, 0, data);
+    return;
+  }
+
+  // Deal out contiguous ranges of tasks to threads
+  std::vector<RNTaskRange> ranges(nthreads);
+  for (int i = 0; i < nthreads; i++) {
+    ranges[i].next = (int) (((long long) ntasks * i) / nthreads);
+    ranges[i].end = (int) (((long long) ntasks * (i + 1)) / nthreads);
+  }
+
+  // Start worker threads (this thread is worker zero)
+  std::vector<std::thread> threads;
+  for (int i = 1; i < nthreads; i++) {
+    threads.push_back(std::thread(RNRunTasks, std::ref(ranges), i, callback, data));
+  }
+
+  // Work on tasks
+  RNRunTasks(ranges, 0, callback, data);
+
+  // Wait for worker threads
+  for (int i = 0; i < (int) threads.size(); i++) {
+    threads[i].join();
+  }
+}
@@ -0,0 +1,18 @@
+/* Include file for GAPS thread utility functions */
+
+
+
+/* Thread count functions */
+
+int RNNumThreads(void);
+void RNSetNumThreads(int nthreads);
+
+
+
+/* Parallel loop functions */
+
+// Calls callback(task_index, thread_index, data) once for every task_index in [0, ntasks).
+// Tasks are dealt out to nthreads workers in contiguous ranges and idle workers
+// steal the upper half of the largest remaining range of another worker.
+// Passing nthreads <= 0 uses RNNumThreads().  Returns once all tasks are done.
+void RNParallelFor(int ntasks, void (*callback)(int, int, void *), void *data = NULL, int nthreads = 0);
@@ -0,0 +1,272 @@
+// Source file for high dynamic range framebuffer functions
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Include files
+////////////////////////////////////////////////////////////////////////
+
+#include "R3Graphics/R3Graphics.h"
+#include "hdrimage.h"
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <chrono>
+
+
+
+// rgb to grayscale consts
+static R3Matrix gray_conv_matrix = R3Matrix(1.0, 0.956, 0.621, 1.0, -0.272, -0.647, 1.0, -1.106, 1.703).Inverse();
+static R3Vector gray_conv_coeffs =  R3Vector(gray_conv_matrix[0][0], gray_conv_matrix[0][1], gray_conv_matrix[0][2]);
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Tone mapping
+////////////////////////////////////////////////////////////////////////
+
+R2Image *
+ToneMapImage(const RNRgb *pixels, int width, int height, RNScalar reinhard_tone_map_a)
+{
+  // Allocate image
+  R2Image *image = new R2Image(width, height);
+  if (!image) {
+    fprintf(stderr, "Unable to allocate image\n");
+    return NULL;
+  }
+
+  // apply tone mapping from Reinhard '02 (into a scratch buffer, so pixels are kept linear)
+  std::vector<RNRgb> mapped(width * height);
+  int pix_count = 0;
+  // get avg luminance
+  RNScalar avg_lum = 0.0;
+  for (int i = 0; i < width; i++) {
+    for (int j = 0; j < height; j++) {
+      RNRgb color = pixels[pix_count];
+      RNScalar curr_lum = gray_conv_coeffs.Dot(R3Vector(color[0], color[1], color[2]));
+      avg_lum += log(RN_EPSILON + curr_lum);
+      pix_count++;
+    }
+  }
+
+  avg_lum /= (height*width);
+  avg_lum = exp(avg_lum);
+
+  // get maximum scaled luminance
+  RNScalar max_t_pix = 0.0;
+  pix_count = 0;
+  for (int i = 0; i < width; i++) {
+    for (int j = 0; j < height; j++) {
+      RNRgb color = pixels[pix_count];
+      RNScalar curr_lum = gray_conv_coeffs.Dot(R3Vector(color[0], color[1], color[2]));
+      RNScalar t_pix = reinhard_tone_map_a * curr_lum / avg_lum;
+      if (t_pix > max_t_pix) {
+        max_t_pix = t_pix;
+      }
+      pix_count++;
+    }
+  }
+
+  // apply operator
+  RNScalar global_max_color = 0.0;
+  pix_count = 0;
+  for (int i = 0; i < width; i++) {
+    for (int j = 0; j < height; j++) {
+      RNRgb color = pixels[pix_count];
+      RNScalar curr_lum = gray_conv_coeffs.Dot(R3Vector(color[0], color[1], color[2]));
+      RNScalar scaling = 1;
+      RNScalar tone_map = 0;
+      if (RNIsPositive(curr_lum)) {
+        RNScalar t_pix = reinhard_tone_map_a * curr_lum / avg_lum;
+        tone_map = t_pix * (1 + (t_pix / pow(max_t_pix, 2))) / (1 + t_pix);
+        scaling = tone_map / curr_lum; 
+      }
+      color *= scaling;
+      // get_max_color
+      RNScalar max_color =  std::max({color[0],color[1], color[2]});      
+      if (max_color > global_max_color) {
+        global_max_color = max_color;
+      }
+      mapped[pix_count] = color;
+      pix_count++;
+    }
+  }
+
+  // normalize pixel values
+  pix_count = 0;
+  for (int i = 0; i < width; i++) {
+    for (int j = 0; j < height; j++) {
+      RNRgb color = mapped[pix_count];
+      color /= global_max_color;
+      image->SetPixelRGB(i, j, color);
+      pix_count++;
+    }
+  }
+  return image;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Sample count heatmaps
+////////////////////////////////////////////////////////////////////////
+
+R2Image *
+SampleCountImage(const int *counts, int width, int height, int max_count)
+{
+  // Allocate image
+  R2Image *image = new R2Image(width, height);
+  if (!image) {
+    fprintf(stderr, "Unable to allocate image\n");
+    return NULL;
+  }
+
+  // Color pixels with "hot" ramp of their fraction of max_count
+  for (int i = 0; i < width; i++) {
+    for (int j = 0; j < height; j++) {
+      RNScalar t = (max_count > 0) ? (RNScalar) counts[i * height + j] / max_count : 0;
+      RNScalar r = std::min(std::max(3 * t, RNScalar(0)), RNScalar(1));
+      RNScalar g = std::min(std::max(3 * t - 1, RNScalar(0)), RNScalar(1));
+      RNScalar b = std::min(std::max(3 * t - 2, RNScalar(0)), RNScalar(1));
+      image->SetPixelRGB(i, j, RNRgb(r, g, b));
+    }
+  }
+  return image;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// PFM files
+////////////////////////////////////////////////////////////////////////
+
+// Color PFM files hold a text header ("PF", width and height, and a scale
+// whose sign gives the byte order) followed by rows of float RGB values from
+// the bottom of the image up.  Framebuffer pixel (i, j) is column i of row j.
+
+static int
+IsLittleEndian(void)
+{
+  // Check byte order of this machine
+  unsigned int one = 1;
+  return (*((unsigned char *) &one) == 1);
+}
+
+
+
+int
+WritePFM(const char *filename, const RNRgb *pixels, int width, int height)
+{
+  // Open file
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    fprintf(stderr, "Unable to open image file %s\n", filename);
+    return 0;
+  }
+
+  // Write header (negative scale means little endian)
+  fprintf(fp, "PF\n%d %d\n%s\n", width, height, (IsLittleEndian()) ? "-1.0" : "1.0");
+
+  // Write rows
+  std::vector<float> row(3 * width);
+  int status = 1;
+  for (int j = 0; (j < height) && status; j++) {
+    for (int i = 0; i < width; i++) {
+      const RNRgb& color = pixels[i * height + j];
+      row[3*i+0] = (float) color.R();
+      row[3*i+1] = (float) color.G();
+      row[3*i+2] = (float) color.B();
+    }
+    if (fwrite(row.data(), sizeof(float), 3 * width, fp) != (size_t) (3 * width)) status = 0;
+  }
+
+  // Close file
+  if (fclose(fp) != 0) status = 0;
+  if (!status) fprintf(stderr, "Unable to write image file %s\n", filename);
+  return status;
+}
+
+
+
+int
+ReadPFM(const char *filename, std::vector<RNRgb>& pixels, int *width, int *height)
+{
+  // Open file
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) {
+    fprintf(stderr, "Unable to open image file %s\n", filename);
+    return 0;
+  }
+
+  // Read header
+  char magic[3] = { 0 };
+  int w = 0, h = 0;
+  double scale = 0;
+  if ((fscanf(fp, "%2s %d %d %lf", magic, &w, &h, &scale) != 4) || strcmp(magic, "PF") ||
+      (w <= 0) || (h <= 0) || (scale == 0) || (fgetc(fp) == EOF)) {
+    fprintf(stderr, "Unable to read color PFM header of %s\n", filename);
+    fclose(fp);
+    return 0;
+  }
+
+  // Read rows, swapping bytes if file has other byte order
+  int swap = ((scale < 0) != (IsLittleEndian() != 0));
+  pixels.resize(w * h);
+  std::vector<float> row(3 * w);
+  for (int j = 0; j < h; j++) {
+    if (fread(row.data(), sizeof(float), 3 * w, fp) != (size_t) (3 * w)) {
+      fprintf(stderr, "Unable to read pixels of %s\n", filename);
+      fclose(fp);
+      return 0;
+    }
+    if (swap) {
+      for (int k = 0; k < 3 * w; k++) {
+        unsigned char *b = (unsigned char *) &row[k];
+        std::swap(b[0], b[3]);
+        std::swap(b[1], b[2]);
+      }
+    }
+    for (int i = 0; i < w; i++) {
+      pixels[i * h + j] = RNRgb(row[3*i+0], row[3*i+1], row[3*i+2]);
+    }
+  }
+
+  // Close file
+  fclose(fp);
+
+  // Return success
+  *width = w;
+  *height = h;
+  return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// CSV files
+////////////////////////////////////////////////////////////////////////
+
+int
+WritePixelsCSV(const RNRgb *pixels, int width, int height, RNScalar reinhard_tone_map_a)
+{
+  // Name file after size, gray conversion, tone map constant and time (for makeimage.py)
+  std::string width_str = std::to_string(width);
+  std::string height_str = std::to_string(height);
+  std::string now = std::to_string(std::chrono::time_point_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now()).time_since_epoch().count());
+  std::string grey_conv = std::to_string(double(gray_conv_coeffs[0])) +  "=" + std::to_string(double(gray_conv_coeffs[1])) + "=" + std::to_string(double(gray_conv_coeffs[2]));
+  std::string tone_map = std::to_string(reinhard_tone_map_a);
+  std::ofstream f;
+  f.open(width_str + ":" + height_str + ":"  + grey_conv + ":" + tone_map + ":"  + now + ".csv");
+  if (!f) return 0;
+  f << "pixel number,r,g,b\n";
+  int pix_count = 0;
+  for (int i = 0; i < width; i++) {
+    for (int j = 0; j < height; j++) {
+      f << std::to_string(double(pixels[pix_count][0])) + "," + std::to_string(pixels[pix_count][1]) + "," + std::to_string(pixels[pix_count][2]) + "\n";
+      pix_count++;
+    }
+  } 
+  return 1;
+}
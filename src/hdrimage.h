@@ -0,0 +1,27 @@
+// Include file for high dynamic range framebuffer functions
+
+#ifndef __HDRIMAGE__H__
+#define __HDRIMAGE__H__
+
+#include <vector>
+
+
+
+// Framebuffers hold linear radiance, pixel (i, j) is at i * height + j
+
+// Apply Reinhard '02 tone mapping with key tone_map_const and normalize into an image
+R2Image *ToneMapImage(const RNRgb *pixels, int width, int height, RNScalar tone_map_const);
+
+// Map number of samples of every pixel to an image, black (none) through red and yellow to white (max_count)
+R2Image *SampleCountImage(const int *counts, int width, int height, int max_count);
+
+// Read and write color PFM files
+int WritePFM(const char *filename, const RNRgb *pixels, int width, int height);
+int ReadPFM(const char *filename, std::vector<RNRgb>& pixels, int *width, int *height);
+
+// Write pixels as CSV text named after size, tone map constant and time (for makeimage.py)
+int WritePixelsCSV(const RNRgb *pixels, int width, int height, RNScalar tone_map_const);
+
+
+
+#endif
@@ -8,6 +8,7 @@
 
 #include "R3Graphics/R3Graphics.h"
 #include "fglut/fglut.h"
+#include "photontree.h"
 
 
 
@@ -34,6 +35,16 @@ static RNLength max_nearby_distance = 0.5;
 static int max_nearby_points = 100;
 static int print_debug = 0;
 static int print_verbose = 0;
+static int point_distribution = 0; // 0 = uniform, 1 = clustered, 2 = surface
+static RNScalar random_seed = 0; // 0 means seed from time
+
+
+
+// Benchmark variables
+
+static int run_benchmark = 0; // time queries without a window
+static int num_queries = 100000;
+static RNLength benchmark_radius = 0; // 0 means radius holding about 100 uniform points
 
 
 
@@ -380,6 +391,65 @@ void GLUTMainLoop(void)
 // Data creation
 ////////////////////////////////////////////////////////////////////////
 
+// names of point distributions
+static const char *distribution_names[3] = { "uniform", "clustered", "surface" };
+
+// gaussian clusters of clustered distribution
+static const int num_clusters = 64;
+static const RNLength cluster_deviation = 0.02;
+static R3Point cluster_centers[num_clusters];
+
+
+
+static void
+CreateClusters(void)
+{
+  // Pick cluster centers in unit box
+  for (int k = 0; k < num_clusters; k++) {
+    double x = 1.6 * RNRandomScalar() - 0.8;
+    double y = 1.6 * RNRandomScalar() - 0.8;
+    double z = 1.6 * RNRandomScalar() - 0.8;
+    cluster_centers[k] = R3Point(x, y, z);
+  }
+}
+
+
+
+static R3Point
+RandomPosition(void)
+{
+  // Return random position of point distribution
+  if (point_distribution == 1) {
+    // Gaussian around random cluster center (Box-Muller)
+    const R3Point& center = cluster_centers[(int) (num_clusters * RNRandomScalar()) % num_clusters];
+    R3Vector offset;
+    for (int dim = 0; dim < 3; dim++) {
+      double u = RN_EPSILON + RNRandomScalar();
+      double v = RNRandomScalar();
+      offset[dim] = cluster_deviation * sqrt(-2.0 * log(u)) * cos(RN_TWO_PI * v);
+    }
+    return center + offset;
+  }
+  else if (point_distribution == 2) {
+    // Uniform on faces of unit box, like photons on the walls of a room
+    int face = (int) (6 * RNRandomScalar()) % 6;
+    RNDimension dim = face / 2;
+    R3Point position;
+    position[dim] = (face % 2) ? 1.0 : -1.0;
+    position[(dim + 1) % 3] = 2.0 * RNRandomScalar() - 1.0;
+    position[(dim + 2) % 3] = 2.0 * RNRandomScalar() - 1.0;
+    return position;
+  }
+  else {
+    // Uniform in unit box
+    double x = 2.0 * RNRandomScalar() - 1.0;
+    double y = 2.0 * RNRandomScalar() - 1.0;
+    double z = 2.0 * RNRandomScalar() - 1.0;
+    return R3Point(x, y, z);
+  }
+}
+
+
 static R3Point 
 GetTestPointPosition(TestPoint *point, void *dummy)
 {
@@ -435,14 +505,14 @@ CreatePoints(void)
   RNTime start_time;
   start_time.Read();
 
-  // Create points at random positions in unit box
-  RNSeedRandomScalar();
+  // Create points at random positions of distribution (in one block, so millions of points are cheap)
+  RNSeedRandomScalar(random_seed);
+  CreateClusters();
+  TestPoint *points = new TestPoint [ max_total_points ];
+  all_points.Resize(max_total_points);
   for (int i = 0; i < max_total_points; i++) {
-    TestPoint *point = new TestPoint();
-    double x = 2.0 * RNRandomScalar() - 1.0;
-    double y = 2.0 * RNRandomScalar() - 1.0;
-    double z = 2.0 * RNRandomScalar() - 1.0;
-    point->position = R3Point(x, y, z);
+    TestPoint *point = &points[i];
+    point->position = RandomPosition();
     point->id = i;
     all_points.Insert(point);
   }
@@ -452,6 +522,7 @@ CreatePoints(void)
     printf("Created points ...\n");
     printf("  Time = %.2f seconds\n", start_time.Elapsed());
     printf("  # Points = %d\n", all_points.NEntries());
+    printf("  Distribution = %s\n", distribution_names[point_distribution]);
     fflush(stdout);
   }
 
@@ -476,6 +547,135 @@ CreateViewer(void)
 
 
 
+////////////////////////////////////////////////////////////////////////
+// Benchmark
+////////////////////////////////////////////////////////////////////////
+
+// visitor that counts points within radius (as a density estimate would sum them)
+struct PointCounter {
+  PointCounter(void) : npoints(0), sum_distance_squared(0) {}
+  template <class PtrType>
+  void operator()(PtrType point, RNLength distance_squared) { npoints++; sum_distance_squared += distance_squared; }
+  long long npoints;
+  RNLength sum_distance_squared;
+};
+
+
+
+
+static void
+PrintQueryTimes(const char *query, const char *tree, RNScalar seconds, long long nfound, long long nvisited)
+{
+  // Print time and results per query (nvisited < 0 means not counted)
+  printf("  %-16s %-14s %10.3f %12.1f", query, tree,
+    1.0E6 * seconds / num_queries, (double) nfound / num_queries);
+  if (nvisited >= 0) printf(" %12.1f\n", (double) nvisited / num_queries);
+  else printf(" %12s\n", "-");
+  fflush(stdout);
+}
+
+
+
+static int
+RunBenchmark(void)
+{
+  // Build photon map kd-tree over the same points
+  RNTime start_time;
+  start_time.Read();
+  PhotonArena arena;
+  for (int i = 0; i < all_points.NEntries(); i++) {
+    PhotonRecord *record = arena.Allocate();
+    memset(record, 0, sizeof(PhotonRecord));
+    record->SetPosition(all_points.Kth(i)->position);
+    record->id = i;
+  }
+  RNScalar copy_time = start_time.Elapsed();
+  start_time.Read();
+  PhotonKdtree photon_tree(arena);
+  RNScalar photon_tree_time = start_time.Elapsed();
+  arena.Empty();
+  printf("Built photon map kd-tree ...\n");
+  printf("  Time = %.2f seconds (plus %.2f seconds to fill records)\n", photon_tree_time, copy_time);
+  printf("  # Photons = %d\n", photon_tree.NPhotons());
+
+  // Create query positions from the same distribution
+  std::vector<R3Point> queries(num_queries);
+  for (int i = 0; i < num_queries; i++) queries[i] = RandomPosition();
+
+  // Choose search radius that holds about 100 points of a uniform distribution
+  RNLength radius = benchmark_radius;
+  if (radius <= 0) radius = pow(3.0 * 8.0 * 100.0 / (4.0 * RN_PI * all_points.NEntries()), 1.0 / 3.0);
+  printf("Timing queries ...\n");
+  printf("  # Queries = %d\n", num_queries);
+  printf("  Radius = %g\n", radius);
+  printf("  %-16s %-14s %10s %12s %12s\n", "Query", "Tree", "us/query", "found/query", "visited/query");
+
+  // Time closest k points within radius
+  static const int ks[4] = { 1, 10, 50, 150 };
+  RNArray<TestPoint *> points;
+  const PhotonRecord *closest[150];
+  RNLength distances_squared[150];
+  for (int n = 0; n < 4; n++) {
+    int k = ks[n];
+    char query[64];
+    sprintf(query, "knn k=%d", k);
+
+    long long nfound = 0;
+    start_time.Read();
+    for (int i = 0; i < num_queries; i++) {
+      points.Empty();
+      nfound += kdtree->FindClosest(queries[i], 0, radius, k, points);
+    }
+    PrintQueryTimes(query, "R3Kdtree", start_time.Elapsed(), nfound, -1);
+
+    nfound = 0;
+    long long nvisited = 0;
+    start_time.Read();
+    for (int i = 0; i < num_queries; i++) {
+      nfound += photon_tree.FindClosest(queries[i], radius, k, closest, distances_squared, &nvisited);
+    }
+    PrintQueryTimes(query, "PhotonKdtree", start_time.Elapsed(), nfound, nvisited);
+  }
+
+  // Time all points within radius
+  long long nfound = 0;
+  start_time.Read();
+  for (int i = 0; i < num_queries; i++) {
+    points.Empty();
+    nfound += kdtree->FindAll(queries[i], 0, radius, points);
+  }
+  PrintQueryTimes("all in radius", "R3Kdtree", start_time.Elapsed(), nfound, -1);
+
+  nfound = 0;
+  RNArray<const PhotonRecord *> found_photons;
+  start_time.Read();
+  for (int i = 0; i < num_queries; i++) {
+    found_photons.Empty();
+    nfound += photon_tree.FindAll(queries[i], radius, found_photons);
+  }
+  PrintQueryTimes("all in radius", "PhotonKdtree", start_time.Elapsed(), nfound, -1);
+
+  // Time visiting all points within radius
+  PointCounter counter;
+  start_time.Read();
+  for (int i = 0; i < num_queries; i++) {
+    kdtree->ForEachWithin(queries[i], radius, counter);
+  }
+  PrintQueryTimes("visit in radius", "R3Kdtree", start_time.Elapsed(), counter.npoints, -1);
+
+  PointCounter photon_counter;
+  start_time.Read();
+  for (int i = 0; i < num_queries; i++) {
+    photon_tree.ForEachWithin(queries[i], radius, photon_counter);
+  }
+  PrintQueryTimes("visit in radius", "PhotonKdtree", start_time.Elapsed(), photon_counter.npoints, -1);
+
+  // Return success
+  return 1;
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////
 // Program argument parsing
 ////////////////////////////////////////////////////////////////////////
@@ -492,6 +692,13 @@ ParseArgs(int argc, char **argv)
     else if (!strcmp(*argv, "-min_nearby_distance")) { argv++; argc--; min_nearby_distance = atof(*argv); }
     else if (!strcmp(*argv, "-max_nearby_distance")) { argv++; argc--; max_nearby_distance = atof(*argv); }
     else if (!strcmp(*argv, "-max_nearby_points")) { argv++; argc--; max_nearby_points = atoi(*argv); }
+    else if (!strcmp(*argv, "-seed")) { argv++; argc--; random_seed = atof(*argv); }
+    else if (!strcmp(*argv, "-uniform")) point_distribution = 0;
+    else if (!strcmp(*argv, "-clustered")) point_distribution = 1;
+    else if (!strcmp(*argv, "-surface")) point_distribution = 2;
+    else if (!strcmp(*argv, "-bench")) run_benchmark = 1;
+    else if (!strcmp(*argv, "-num_queries")) { argv++; argc--; num_queries = atoi(*argv); }
+    else if (!strcmp(*argv, "-radius")) { argv++; argc--; benchmark_radius = atof(*argv); }
     else { fprintf(stderr, "Invalid program argument: %s", *argv); exit(1); }
     argv++; argc--;
   }
@@ -508,8 +715,9 @@ ParseArgs(int argc, char **argv)
 
 int main(int argc, char **argv)
 {
-  // Initialize GLUT
-  GLUTInit(&argc, argv);
+  // Initialize GLUT (unless only timing queries, which needs no display)
+  for (int i = 1; i < argc; i++) if (!strcmp(argv[i], "-bench")) run_benchmark = 1;
+  if (!run_benchmark) GLUTInit(&argc, argv);
 
   // Parse program arguments
   if (!ParseArgs(argc, argv)) exit(-1);
@@ -517,6 +725,12 @@ int main(int argc, char **argv)
   // Create everything points
   if (!CreatePoints()) exit(-1);
   if (!CreateKdtree()) exit(-1);
+
+  // Time queries and exit
+  if (run_benchmark) {
+    if (!RunBenchmark()) exit(-1);
+    return 0;
+  }
   if (!CreateViewer()) exit(-1);
 
   // Run GLUT interface
@@ -8,6 +8,7 @@
 #include "R3Graphics/R3Graphics.h"
 #include "fglut/fglut.h"
 #include "render.h"
+#include "projectionmap.h"
 #include <iostream>
 #include <vector>
 #include <initializer_list>
@@ -49,16 +50,36 @@ static int render_image_height = 200;
 static int num_photons = 500000;
 static int num_caustics = 1000000;
 static int num_samples = 20;
+static RNScalar target_error = 0; // relative standard error at which pixels stop sampling (0 means num_samples in every pixel)
+static int max_samples = 0; // most samples of one pixel when target_error is set (0 means 4 * num_samples)
+static char *sample_heatmap_name = NULL; // image of samples taken by every pixel
 static RNScalar tone_map_const = 0.3;
 static RNScalar general_search_range = 0.07; // as a proprtion of radius of bounding box of scene
 static RNScalar caustic_search_range = 0.1; // as a proprtion of radius of bounding box of scene
 static int num_photon_estimate = 150;
-
-
-static RNArray<Photon *> photon_list;
-static R3Kdtree<Photon *> *photon_map;
-static R3Kdtree<Photon *> *caustic_map;
-static RNArray<Photon *> caustic_list;
+static int irradiance_stride = 0; // precompute irradiance at every Nth global photon (0 means never)
+static int sppm_passes = 0; // number of stochastic progressive photon mapping passes (0 means regular photon mapping)
+static int sppm_photons = 100000; // photons emitted per progressive pass
+static RNScalar sppm_alpha = 0.7; // fraction of new photons kept when progressive radii shrink
+static RNScalar time_budget = 0; // seconds after which progressive passes stop (0 means no limit)
+static int write_csv = 0; // also write pixels as CSV text for makeimage.py
+static char *stats_name = NULL; // JSON file for phase times and counters
+static int projection_map_resolution = 32; // cells per side of light projection maps (0 means emit everywhere)
+static int use_wavefront = 0; // trace batches of paths breadth first instead of one path at a time
+static int num_threads = 0; // 0 means one per hardware thread
+static RNScalar random_seed = 0; // 0 means seed from time
+static int random_sequence = RN_PHILOX_SEQUENCE; // random numbers of photons and pixel samples (or Halton or Sobol points)
+
+
+static PhotonKdtree *photon_map;
+static PhotonKdtree *caustic_map;
+static PhotonKdtree *irradiance_map = NULL;
+static PhotonMapFile photon_map_file; // keeps loaded photon maps mapped
+static char *save_photon_map_name = NULL;
+static char *load_photon_map_name = NULL;
+static std::vector<PhotonDebugInfo> photon_debug_info; // only filled for the viewer
+static std::vector<PhotonDebugInfo> caustic_debug_info;
+static std::vector<ProjectionMap> projection_maps; // one per light, built on first emission
 
 // Display variables
 
@@ -157,23 +178,27 @@ DrawCamera(R3Scene *scene)
 
 
 static void 
-DrawPhotons(R3Scene *scene, RNArray<Photon *> photon_list, R3Kdtree<Photon *> *photon_map)
+DrawPhotons(R3Scene *scene, PhotonKdtree *photon_map, const std::vector<PhotonDebugInfo>& debug_info)
 {
   // Draw all lights
   double radius = scene->BBox().DiagonalRadius();
   R3Point camera_pos = scene->Camera().Origin();
-  for (int i = 0; i < photon_list.NEntries(); i++) {
-    Photon *photon = photon_list[i];
+  for (int i = 0; i < photon_map->NPhotons(); i++) {
+    const PhotonRecord *photon = photon_map->Record(i);
+    R3Point position = photon->Position();
+    RNRgb power = photon->Power();
     int ab = 100000;
-    glColor3d(photon->power[0] * ab, photon->power[1] * ab, photon->power[2] * ab);
-    R3Sphere(photon->position, 0.005 * radius).Draw();
+    glColor3d(power[0] * ab, power[1] * ab, power[2] * ab);
+    R3Sphere(position, 0.005 * radius).Draw();
     R3Sphere(R3Point(-10.0, -2.0, -12.0), 0.005 * radius).Draw();
+    if (photon->id >= debug_info.size()) continue;
+    const PhotonDebugInfo& debug = debug_info[photon->id];
    
-    R3Span(photon->position, photon->source).Draw();
+    R3Span(position, debug.source).Draw();
     glColor3d(0.7, 1.0, 0.2);
-    R3Span(photon->position, photon->position + 0.02 * radius * photon->normal).Draw();
+    R3Span(position, position + 0.02 * radius * debug.normal).Draw();
     glColor3d(0.2, 1.0, 0.7);
-    R3Span(photon->position, photon->position + 0.05 * radius * photon->out_direction).Draw();
+    R3Span(position, position + 0.05 * radius * debug.out_direction).Draw();
     
     // R3Vector mirrored = photon->direction - (2 * photon->direction.Dot(photon->normal) * photon->normal);
    
@@ -182,26 +207,28 @@ DrawPhotons(R3Scene *scene, RNArray<Photon *> photon_list, R3Kdtree<Photon *> *p
 }
 
 static void 
-DrawNearestPhotons(R3Scene *scene, RNArray<Photon *> photon_list, R3Kdtree<Photon *> *photon_map)
+DrawNearestPhotons(R3Scene *scene, PhotonKdtree *photon_map)
 {
   // Draw all lights
   double radius = scene->BBox().DiagonalRadius();
   R3Point camera_pos = scene->Camera().Origin();
 
-  for (int i = 0; i < 5; i++) {
-    Photon *source_photon = photon_list[i];
-    R3Span(camera_pos, source_photon->position).Draw();
-    RNArray<Photon *> nearby_photons;
-    photon_map->FindClosest(source_photon, RNScalar(0), radius, 500, nearby_photons);
-    if (nearby_photons.NEntries() == 0) {
+  for (int i = 0; i < 5 && i < photon_map->NPhotons(); i++) {
+    R3Point source_position = photon_map->Record(i)->Position();
+    R3Span(camera_pos, source_position).Draw();
+    const PhotonRecord *nearby_photons[500];
+    RNLength distances_squared[500];
+    int num_nearby = photon_map->FindClosest(source_position, radius, 500, nearby_photons, distances_squared);
+    if (num_nearby == 0) {
       continue;
     }
 
-    for (int p = 0; p < nearby_photons.NEntries(); p++) {
-      Photon *near_photon = nearby_photons[p];
+    for (int p = 0; p < num_nearby; p++) {
+      const PhotonRecord *near_photon = nearby_photons[p];
       int ab = 100000;
-      glColor3d(near_photon->power[0] * ab, near_photon->power[1] * ab, near_photon->power[2] * ab);
-      R3Sphere(near_photon->position, 0.005 * radius).Draw();
+      RNRgb power = near_photon->Power();
+      glColor3d(power[0] * ab, power[1] * ab, power[2] * ab);
+      R3Sphere(near_photon->Position(), 0.005 * radius).Draw();
     }
     glColor3d(0.0, 1.0, 0.0);
   }
@@ -398,7 +425,7 @@ void GLUTRedraw(void)
     glDisable(GL_LIGHTING);
     glColor3d(0.0, 1.0, 0.0);
     glLineWidth(3);
-    DrawPhotons(scene, photon_list, photon_map);
+    DrawPhotons(scene, photon_map, photon_debug_info);
     glLineWidth(1);
   }
 
@@ -407,7 +434,7 @@ void GLUTRedraw(void)
     glDisable(GL_LIGHTING);
     glColor3d(0.0, 1.0, 0.0);
     glLineWidth(3);
-    DrawPhotons(scene, caustic_list, caustic_map);
+    DrawPhotons(scene, caustic_map, caustic_debug_info);
     glLineWidth(1);
   }
 
@@ -416,8 +443,8 @@ void GLUTRedraw(void)
     glDisable(GL_LIGHTING);
     glColor3d(0.0, 1.0, 0.0);
     glLineWidth(3);
-    DrawNearestPhotons(scene, photon_list, photon_map);
-    DrawNearestPhotons(scene, caustic_list, caustic_map);
+    DrawNearestPhotons(scene, photon_map);
+    DrawNearestPhotons(scene, caustic_map);
     glLineWidth(1);
   }
 
@@ -782,11 +809,31 @@ ParseArgs(int argc, char **argv)
     if ((*argv)[0] == '-') {
       if (!strcmp(*argv, "-v")) {
         print_verbose = 1; 
+      } else if (!strcmp(*argv, "-csv")) {
+        write_csv = 1; 
+      } else if (!strcmp(*argv, "-stats")) {
+        argc--; argv++; stats_name = *argv;
+      } else if (!strcmp(*argv, "-projection_map_resolution")) {
+        argc--; argv++; projection_map_resolution = atoi(*argv);
+      } else if (!strcmp(*argv, "-wavefront")) {
+        use_wavefront = 1;
+      } else if (!strcmp(*argv, "-sampler")) {
+        argc--; argv++;
+        if (!strcmp(*argv, "random")) random_sequence = RN_PHILOX_SEQUENCE;
+        else if (!strcmp(*argv, "halton")) random_sequence = RN_HALTON_SEQUENCE;
+        else if (!strcmp(*argv, "sobol")) random_sequence = RN_SOBOL_SEQUENCE;
+        else { fprintf(stderr, "Invalid sampler: %s (use random, halton or sobol)\n", *argv); exit(1); }
       } else if (!strcmp(*argv, "-resolution")) { 
         argc--; argv++; render_image_width = atoi(*argv); 
         argc--; argv++; render_image_height = atoi(*argv); 
       } else if (!strcmp(*argv, "-num_samples")) { 
         argc--; argv++; num_samples = atoi(*argv); 
+      } else if (!strcmp(*argv, "-target_error")) {
+        argc--; argv++; target_error = atof(*argv);
+      } else if (!strcmp(*argv, "-max_samples")) {
+        argc--; argv++; max_samples = atoi(*argv);
+      } else if (!strcmp(*argv, "-sample_heatmap")) {
+        argc--; argv++; sample_heatmap_name = *argv;
       } else if (!strcmp(*argv, "-general_search_range")) { 
         argc--; argv++; general_search_range = atof(*argv); 
       } else if (!strcmp(*argv, "-caustic_search_range")) { 
@@ -797,8 +844,26 @@ ParseArgs(int argc, char **argv)
         argc--; argv++; num_caustics = atoi(*argv); 
       } else if (!strcmp(*argv, "-num_photon_estimate")) { 
         argc--; argv++; num_photon_estimate = atoi(*argv); 
+      } else if (!strcmp(*argv, "-precompute_irradiance")) { 
+        argc--; argv++; irradiance_stride = atoi(*argv); 
+      } else if (!strcmp(*argv, "-save_photon_map")) { 
+        argc--; argv++; save_photon_map_name = *argv; 
+      } else if (!strcmp(*argv, "-load_photon_map")) { 
+        argc--; argv++; load_photon_map_name = *argv; 
+      } else if (!strcmp(*argv, "-sppm")) { 
+        argc--; argv++; sppm_passes = atoi(*argv); 
+      } else if (!strcmp(*argv, "-sppm_photons")) { 
+        argc--; argv++; sppm_photons = atoi(*argv); 
+      } else if (!strcmp(*argv, "-sppm_alpha")) { 
+        argc--; argv++; sppm_alpha = atof(*argv); 
+      } else if (!strcmp(*argv, "-time_budget")) { 
+        argc--; argv++; time_budget = atof(*argv); 
       } else if (!strcmp(*argv, "-tone_map_const")) { 
         argc--; argv++; tone_map_const = atof(*argv); 
+      } else if (!strcmp(*argv, "-num_threads")) { 
+        argc--; argv++; num_threads = atoi(*argv); 
+      } else if (!strcmp(*argv, "-seed")) { 
+        argc--; argv++; random_seed = atof(*argv); 
       } else { 
         fprintf(stderr, "Invalid program argument: %s", *argv); 
         exit(1); 
@@ -853,11 +918,6 @@ void getR3CircleAxes(R3Vector normal, R3Vector *axis1, R3Vector *axis2)
       *axis2 = normal % *axis1;
       axis2->Normalize();
 }
-R3Point GetPhotonPosition(Photon *photon, void *dummy)
-{
-  return photon->position;
-}
-
 RNScalar getInteractionProbability(RNRgb power, RNRgb coeff)
 { 
   RNScalar numer = std::max({power[0] * coeff[0], power[1] * coeff[1], power[2] * coeff[2]});
@@ -865,7 +925,7 @@ RNScalar getInteractionProbability(RNRgb power, RNRgb coeff)
   return numer/denom;
 }
 
-void photonInteraction(const R3Brdf *brdf, RNScalar *prev_ior, const Photon* in, const R3Vector&  normal, RNRgb *out_power, R3Vector *out_direction, bool *absorbed, bool *is_diffuse, bool *is_specular_reflection)
+void photonInteraction(const R3Brdf *brdf, RNScalar *prev_ior, const Photon* in, const R3Vector&  normal, RNRgb *out_power, R3Vector *out_direction, bool *absorbed, bool *is_diffuse, bool *is_specular_reflection, RNRandomGenerator *generator)
 { 
   *absorbed = false;
   *is_diffuse = false;
@@ -874,10 +934,11 @@ void photonInteraction(const R3Brdf *brdf, RNScalar *prev_ior, const Photon* in,
   RNScalar trans = getInteractionProbability(in->power, brdf->Transmission());
   RNScalar absorb = 1 - diff - spec - trans;
 
-  // scale probabilities if material does not objey conservation of 
-  // energy
+  // scale coefficients (and so probabilities) if material does not obey conservation of
+  // energy, otherwise dividing by the scaled probabilities makes every bounce add power
+  RNScalar scaling = 1;
   if (RNIsGreater(diff + spec + trans, 1)) {
-    RNScalar scaling =  RNScalar(1) / (diff + spec + trans);
+    scaling =  RNScalar(1) / (diff + spec + trans);
     diff *= scaling;
     spec *= scaling;
     trans *= scaling;
@@ -887,17 +948,17 @@ void photonInteraction(const R3Brdf *brdf, RNScalar *prev_ior, const Photon* in,
   // assert(RNIsEqual(diff + spec + trans + absorb, 1));
 
   // Determine type of bounce and set new direction and power.
-  RNScalar ksi = RNRandomScalar(); // random variable ksi
+  RNScalar ksi = generator->Scalar(); // random variable ksi
   if (ksi < diff) {
     // DIFFUSE case
-    *out_power = (in->power * brdf->Diffuse()) / diff; 
+    *out_power = (in->power * brdf->Diffuse()) * scaling / diff;
     *is_diffuse = true;
     R3Vector rotation_axis;
     RNScalar rotation_angle;
     getConversionRotation(R3Vector(0,0,1), normal, &rotation_angle, &rotation_axis);
 
-    RNScalar z = sqrt(RNRandomScalar());
-    RNScalar  phi = RN_TWO_PI * RNRandomScalar();
+    RNScalar z = sqrt(generator->Scalar());
+    RNScalar  phi = RN_TWO_PI * generator->Scalar();
     RNScalar theta = acos(z); 
     RNScalar sin_theta = sin(theta);
     RNScalar x = sin_theta * cos(phi);
@@ -909,7 +970,7 @@ void photonInteraction(const R3Brdf *brdf, RNScalar *prev_ior, const Photon* in,
   }
   else if (ksi <= diff + spec) {
     // SPECULAR case
-    *out_power = (in->power * brdf->Specular()) / spec;
+    *out_power = (in->power * brdf->Specular()) * scaling / spec;
     *is_specular_reflection = true;
     R3Vector rotation_axis;
     RNScalar rotation_angle;
@@ -922,9 +983,9 @@ void photonInteraction(const R3Brdf *brdf, RNScalar *prev_ior, const Photon* in,
       return;
     }
     do {
-      RNScalar z = pow(RNRandomScalar(), RNScalar(1)/ brdf->Shininess());
+      RNScalar z = pow(generator->Scalar(), RNScalar(1)/ brdf->Shininess());
       RNScalar alpha = acos(z); // angle between refleccted and ideal specular ray 
-      RNScalar phi = RNRandomScalar() * RN_TWO_PI;
+      RNScalar phi = generator->Scalar() * RN_TWO_PI;
       RNScalar sin_alpha = sin(alpha);
       RNScalar x = sin_alpha * cos(phi);
       RNScalar y = sin_alpha * sin(phi);
@@ -935,7 +996,7 @@ void photonInteraction(const R3Brdf *brdf, RNScalar *prev_ior, const Photon* in,
     *out_direction = dir;
   } else if (ksi <= diff + spec + trans) {
   // TRANSMITTED case
-    *out_power = (in->power * brdf->Transmission()) / trans;
+    *out_power = (in->power * brdf->Transmission()) * scaling / trans;
     RNScalar n1;
     RNScalar n2;
     bool flip_normal = false;
@@ -971,7 +1032,7 @@ void photonInteraction(const R3Brdf *brdf, RNScalar *prev_ior, const Photon* in,
       reflect_prob = 1;
     }
 
-    if (RNRandomScalar() < reflect_prob) {
+    if (generator->Scalar() < reflect_prob) {
       *out_direction = in->direction - (2 * cos_theta * trans_normal);
       return;
     }
@@ -985,9 +1046,9 @@ void photonInteraction(const R3Brdf *brdf, RNScalar *prev_ior, const Photon* in,
     getConversionRotation(R3Vector(0,0,1), ideal_refraction, &rotation_angle, &rotation_axis);
     R3Vector dir;
 
-    RNScalar z = pow(RNRandomScalar(), RNScalar(1)/ brdf->Shininess());
+    RNScalar z = pow(generator->Scalar(), RNScalar(1)/ brdf->Shininess());
     RNScalar alpha = acos(z); // angle between refracted and ideal specular ray 
-    RNScalar phi = RNRandomScalar() * RN_TWO_PI;
+    RNScalar phi = generator->Scalar() * RN_TWO_PI;
     RNScalar sin_alpha = sin(alpha);
     RNScalar x = sin_alpha * cos(phi);
     RNScalar y = sin_alpha * sin(phi);
@@ -1003,29 +1064,51 @@ void photonInteraction(const R3Brdf *brdf, RNScalar *prev_ior, const Photon* in,
   }
 }
 
-void tracePhoton(R3Scene *scene, RNScalar *prev_ior, Photon *in_photon,  RNArray<Photon *> &photon_list, bool is_caustic_map)
+// stores photon in arena, and its debug fields in debug_info if not NULL
+static void StorePhoton(const Photon& photon, PhotonArena *photons, std::vector<PhotonDebugInfo> *debug_info)
 {
-  // randomly terminate to prevent infinite photon tracing
-  if (RNRandomScalar() < termination_rate) {
-    return;
+  StatsCountStoredPhoton(photon.bounces);
+  PhotonRecord *record = photons->Allocate();
+  memset(record, 0, sizeof(PhotonRecord));
+  record->SetPosition(photon.position);
+  record->SetDirection(photon.direction);
+  record->SetNormal(photon.normal);
+  record->SetPower(photon.power);
+  if (debug_info) {
+    record->id = (unsigned int) debug_info->size();
+    PhotonDebugInfo debug;
+    debug.source = photon.source;
+    debug.normal = photon.normal;
+    debug.out_direction = photon.out_direction;
+    debug_info->push_back(debug);
   }
-  // Convenient variables
-  R3SceneElement *element;
-  R3Point point;
-  R3Vector normal;
+}
 
-  in_photon->direction.Normalize();
-  R3Ray ray = R3Ray(in_photon->source, in_photon->direction);
+// returns true if photon survives russian roulette and may bounce again
+static bool PhotonContinues(const Photon& photon, RNRandomGenerator *generator)
+{
+  // randomly terminate to prevent infinite photon tracing
+  if (generator->Scalar() < termination_rate) {
+    StatsCount(STATS_PHOTONS_TERMINATED);
+    return false;
+  }
 
-  bool is_bounce_allowed = in_photon->bounces < max_bounces;
+  bool is_bounce_allowed = photon.bounces < max_bounces;
   if (max_bounces == -1) {
     is_bounce_allowed = true;
   }
 
-  if (!is_bounce_allowed || !(scene->Intersects(ray, NULL, &element, NULL, &point, &normal, NULL))) {
-    return;
+  if (!is_bounce_allowed) {
+    StatsCount(STATS_PHOTONS_BOUNCE_LIMITED);
+    return false;
   }
+  return true;
+}
 
+// scatters photon at surface point it hit, storing diffuse hits in photons (direct hits only if store_direct);
+// returns true if photon goes on with its outgoing direction and power
+static bool ScatterPhoton(Photon *in_photon, RNScalar *prev_ior, R3SceneElement *element, const R3Point& point, R3Vector normal, PhotonArena *photons, std::vector<PhotonDebugInfo> *debug_info, bool is_caustic_map, bool store_direct, RNRandomGenerator *generator)
+{
   normal.Normalize();
   in_photon->normal = normal;
   in_photon->position = point;
@@ -1039,66 +1122,162 @@ void tracePhoton(R3Scene *scene, RNScalar *prev_ior, Photon *in_photon,  RNArray
   bool is_absorbed = false;
   bool is_diffuse = false;
   bool is_specular_reflection = false;
-  photonInteraction(brdf, prev_ior, in_photon, normal, &out_photon_power, &out_photon_direction,  &is_absorbed, &is_diffuse, &is_specular_reflection);
+  photonInteraction(brdf, prev_ior, in_photon, normal, &out_photon_power, &out_photon_direction,  &is_absorbed, &is_diffuse, &is_specular_reflection, generator);
   if (is_absorbed) {
-    return;
+    StatsCount(STATS_PHOTONS_ABSORBED);
+    return false;
+  }
+  // caustic paths start with a specular bounce or transmission
+  if (is_caustic_map && is_diffuse && (in_photon->bounces == 0)) {
+    StatsCount(STATS_PHOTONS_TERMINATED);
+    return false;
   }
   in_photon->out_direction = out_photon_direction;
-  Photon *out_photon = new Photon();
 
-  if (is_diffuse && in_photon->bounces != 0) {
-    photon_list.Insert(in_photon);
+  if (is_diffuse && (in_photon->bounces != 0 || store_direct)) {
+    StorePhoton(*in_photon, photons, debug_info);
     if (is_caustic_map) {
-      return;
+      return false;
     }
   }
-  out_photon->direction = out_photon_direction;
-  out_photon->direction.Normalize();
-  // displace source slightly to avoid intersecting with same surface due to floating point error
-  out_photon->source = point + RN_EPSILON * out_photon->direction;
-  out_photon->position = point;
-  out_photon->power = out_photon_power;
-  out_photon->bounces = in_photon->bounces + 1;
 
-  tracePhoton(scene, prev_ior, out_photon, photon_list, is_caustic_map);
+  // continue with outgoing photon
+  in_photon->direction = out_photon_direction;
+  in_photon->direction.Normalize();
+  // displace source slightly to avoid intersecting with same surface due to floating point error
+  in_photon->source = point + RN_EPSILON * in_photon->direction;
+  in_photon->position = point;
+  in_photon->power = out_photon_power;
+  in_photon->bounces = in_photon->bounces + 1;
+  return true;
 }
 
-// returns true if ray's first intersection is a specular reflection or transmission
-bool IsRaySpecular(R3Scene *scene, R3Ray ray)
+// traces photon path bounce by bounce, storing diffuse hits in photons (direct hits only if store_direct)
+void tracePhoton(R3Scene *scene, RNScalar *prev_ior, const Photon& emitted_photon, PhotonArena *photons, std::vector<PhotonDebugInfo> *debug_info, bool is_caustic_map, bool store_direct, RNRandomGenerator *generator)
 {
+  // state of photon along path
+  Photon photon = emitted_photon;
+  StatsCount(STATS_PHOTONS_EMITTED);
+
+  while (PhotonContinues(photon, generator)) {
+    photon.direction.Normalize();
+    R3Ray ray = R3Ray(photon.source, photon.direction);
+    StatsCount(STATS_PHOTON_RAYS);
+    R3SceneElement *element;
+    R3Point point;
+    R3Vector normal;
+    if (!(scene->Intersects(ray, NULL, &element, NULL, &point, &normal, NULL))) {
+      StatsCount(STATS_PHOTONS_ESCAPED);
+      return;
+    }
+    if (!ScatterPhoton(&photon, prev_ior, element, point, normal, photons, debug_info, is_caustic_map, store_direct, generator)) return;
+  }
+}
+
+// photon path in flight in the wavefront engine
+struct PhotonPath {
+  Photon photon;
+  RNScalar ior;
+  RNRandomGenerator generator; // random numbers of path, drawn as if it were traced alone
+  R3SceneElement *element;
   R3Point point;
   R3Vector normal;
-  R3SceneElement *element;
-  if (!(scene->Intersects(ray, NULL, &element, NULL, &point, &normal, NULL))) {
-    return false;
+};
+
+// octant of direction, so rays going the same way are intersected together
+static int DirectionOctant(const R3Vector& direction)
+{
+  return ((direction.X() < 0) ? 1 : 0) | ((direction.Y() < 0) ? 2 : 0) | ((direction.Z() < 0) ? 4 : 0);
+}
+
+// traces photon paths breadth first: every stage runs over the whole queue of paths still in flight
+// (continue, sort, intersect, scatter and store), and paths that end are dropped from the queue
+static void tracePhotonsWavefront(R3Scene *scene, std::vector<PhotonPath>& paths, PhotonArena *photons, std::vector<PhotonDebugInfo> *debug_info, bool is_caustic_map, bool store_direct)
+{
+  StatsCount(STATS_PHOTONS_EMITTED, paths.size());
+  std::vector<int> active(paths.size());
+  std::vector<int> sorted(paths.size());
+  for (int i = 0; i < (int) paths.size(); i++) active[i] = i;
+  while (!active.empty()) {
+    // Continue stage: russian roulette and bounce limit
+    int nactive = 0;
+    int octant_counts[9] = { 0 };
+    for (int i = 0; i < (int) active.size(); i++) {
+      PhotonPath& path = paths[active[i]];
+      if (!PhotonContinues(path.photon, &path.generator)) continue;
+      path.photon.direction.Normalize();
+      octant_counts[DirectionOctant(path.photon.direction) + 1]++;
+      active[nactive++] = active[i];
+    }
+
+    // Sort stage: group paths by direction octant (counting sort keeps queue order within octant)
+    for (int k = 1; k < 9; k++) octant_counts[k] += octant_counts[k - 1];
+    for (int i = 0; i < nactive; i++) {
+      sorted[octant_counts[DirectionOctant(paths[active[i]].photon.direction)]++] = active[i];
+    }
+
+    // Intersect stage
+    int nhits = 0;
+    for (int i = 0; i < nactive; i++) {
+      PhotonPath& path = paths[sorted[i]];
+      StatsCount(STATS_PHOTON_RAYS);
+      R3Ray ray = R3Ray(path.photon.source, path.photon.direction);
+      if (!(scene->Intersects(ray, NULL, &path.element, NULL, &path.point, &path.normal, NULL))) {
+        StatsCount(STATS_PHOTONS_ESCAPED);
+        continue;
+      }
+      sorted[nhits++] = sorted[i];
+    }
+
+    // Scatter stage: sample BRDFs and store diffuse hits
+    active.resize(0);
+    for (int i = 0; i < nhits; i++) {
+      PhotonPath& path = paths[sorted[i]];
+      if (!ScatterPhoton(&path.photon, &path.ior, path.element, path.point, path.normal, photons, debug_info, is_caustic_map, store_direct, &path.generator)) continue;
+      active.push_back(sorted[i]);
+    }
   }
+}
+
+// samples interaction of ray with the surface it hit, scaling power_multiplier; returns true if the ray goes on
+// (reflected or refracted specularly into *ray), false if it ends (*is_diffuse tells a diffuse hit from absorption)
+static bool ScatterRaySpecular(R3SceneElement *element, const R3Point& point, const R3Vector& normal, RNScalar *prev_ior, R3Ray *ray, RNRgb *power_multiplier, bool *is_diffuse, RNRandomGenerator *generator)
+{
   // Get intersection information
   const R3Material *material = (element) ? element->Material() : &R3default_material;
   const R3Brdf *brdf = (material) ? (material->Brdf()) : (&R3default_brdf);
 
   bool is_absorbed = false;
-  bool is_diffuse = false;
   bool is_specular_reflection = false;
+  *is_diffuse = false;
 
   Photon in_photon;
-  in_photon.direction = ray.Vector();
+  in_photon.direction = ray->Vector();
   in_photon.direction.Normalize();
   in_photon.power = RNRgb(1,1,1);
   RNRgb out_photon_power;
   R3Vector out_photon_direction;
-  RNScalar prev_ior = camera_index_of_refraction;
-  photonInteraction(brdf, &prev_ior, &in_photon, normal, &out_photon_power, &out_photon_direction,  &is_absorbed, &is_diffuse, &is_specular_reflection);
-  if (is_diffuse || is_absorbed) {
+  photonInteraction(brdf, prev_ior, &in_photon, normal, &out_photon_power, &out_photon_direction,  &is_absorbed, is_diffuse, &is_specular_reflection, generator);
+  out_photon_direction.Normalize();
+  if (is_absorbed) {
+    return false;
+  } else if (*is_diffuse) {
+    *power_multiplier = *power_multiplier * out_photon_power;
     return false;
+  } else if (is_specular_reflection) {
+    // adjust for importance sampling
+    *power_multiplier = *power_multiplier * out_photon_power * (brdf->Shininess() +2) / (brdf->Shininess() + 1);
   }
+  *ray = R3Ray(point + RN_EPSILON * out_photon_direction, out_photon_direction, false);
+  StatsCount(STATS_SPECULAR_RAYS);
   return true;
 }
 
 // reccursively traces ray until a diffuse interaction with a surface
-bool traceRayDiffuse(R3Scene *scene, RNScalar *prev_ior, R3Ray ray, R3Point *point, R3SceneElement **element , R3Vector *normal, RNScalar termination_rate_ray_trace, RNRgb *power_multiplier)
+bool traceRayDiffuse(R3Scene *scene, RNScalar *prev_ior, R3Ray ray, R3Point *point, R3SceneElement **element , R3Vector *normal, RNScalar termination_rate_ray_trace, RNRgb *power_multiplier, RNRandomGenerator *generator)
 { 
   // randomly terminate to prevent infinite photon tracing
-  if (RNRandomScalar() < termination_rate_ray_trace) {
+  if (generator->Scalar() < termination_rate_ray_trace) {
     return false;
   }
 
@@ -1106,60 +1285,243 @@ bool traceRayDiffuse(R3Scene *scene, RNScalar *prev_ior, R3Ray ray, R3Point *poi
     return false;
   }
   normal->Normalize();
-  // Get intersection information
-  const R3Material *material = (*element) ? (*element)->Material() : &R3default_material;
-  const R3Brdf *brdf = (material) ? (material->Brdf()) : (&R3default_brdf);
+  bool is_diffuse;
+  if (!ScatterRaySpecular(*element, *point, *normal, prev_ior, &ray, power_multiplier, &is_diffuse, generator)) {
+    return is_diffuse;
+  }
+  return traceRayDiffuse(scene, prev_ior, ray, point, element, normal, termination_rate_ray_trace, power_multiplier, generator);
+}
 
-  bool is_absorbed = false;
-  bool is_diffuse = false;
-  bool is_specular_reflection = false;
+// traces batch of camera paths breadth first until their first diffuse hit, like traceRayDiffuse does one
+// at a time; every stage runs over all paths still in flight (continue, sort, intersect, scatter)
+void traceRaysDiffuse(R3Scene *scene, DiffusePath *paths, int npaths, RNScalar termination_rate_ray_trace)
+{
+  std::vector<int> active(npaths);
+  std::vector<int> sorted(npaths);
+  for (int i = 0; i < npaths; i++) {
+    paths[i].is_diffuse = false;
+    active[i] = i;
+  }
 
-  Photon in_photon;
-  in_photon.direction = ray.Vector();
-  in_photon.direction.Normalize();
-  in_photon.power = RNRgb(1,1,1);
-  RNRgb out_photon_power;
-  R3Vector out_photon_direction;
-  photonInteraction(brdf, prev_ior, &in_photon, *normal, &out_photon_power, &out_photon_direction,  &is_absorbed, &is_diffuse, &is_specular_reflection);
-  out_photon_direction.Normalize();
-  if (is_absorbed) {
-    return false;
-  } else if (is_diffuse) {
-    *power_multiplier = *power_multiplier * out_photon_power;
-    return true;
-  } else if (is_specular_reflection) {
-    // adjust for importance sampling
-    *power_multiplier = *power_multiplier * out_photon_power * (brdf->Shininess() +2) / (brdf->Shininess() + 1);
+  while (!active.empty()) {
+    // Continue stage: randomly terminate to prevent infinite tracing
+    int nactive = 0;
+    int octant_counts[9] = { 0 };
+    for (int i = 0; i < (int) active.size(); i++) {
+      DiffusePath& path = paths[active[i]];
+      if (path.generator.Scalar() < termination_rate_ray_trace) continue;
+      octant_counts[DirectionOctant(path.ray.Vector()) + 1]++;
+      active[nactive++] = active[i];
+    }
+
+    // Sort stage: group paths by direction octant
+    for (int k = 1; k < 9; k++) octant_counts[k] += octant_counts[k - 1];
+    for (int i = 0; i < nactive; i++) {
+      sorted[octant_counts[DirectionOctant(paths[active[i]].ray.Vector())]++] = active[i];
+    }
+
+    // Intersect stage
+    int nhits = 0;
+    for (int i = 0; i < nactive; i++) {
+      DiffusePath& path = paths[sorted[i]];
+      if (!(scene->Intersects(path.ray, NULL, &path.element, NULL, &path.point, &path.normal, NULL))) continue;
+      path.normal.Normalize();
+      sorted[nhits++] = sorted[i];
+    }
+
+    // Scatter stage: paths that hit diffusely or are absorbed are done
+    active.resize(0);
+    for (int i = 0; i < nhits; i++) {
+      DiffusePath& path = paths[sorted[i]];
+      if (!ScatterRaySpecular(path.element, path.point, path.normal, &path.ior, &path.ray, &path.power_multiplier, &path.is_diffuse, &path.generator)) continue;
+      active.push_back(sorted[i]);
+    }
   }
-  ray = R3Ray(*point + RN_EPSILON * out_photon_direction, out_photon_direction, false);
-  return traceRayDiffuse(scene, prev_ior, ray, point, element, normal, termination_rate_ray_trace, power_multiplier);
 }
 
-RNRgb EstimateFlux(R3Kdtree<Photon *> *photon_map,  R3Point point, int num_photons, RNScalar max_distance, RNRgb diffuseBrdf) {
-  RNArray<Photon *> nearby;
-  RNLength *distances = new RNLength[num_photons];
-  photon_map->FindClosest(point, RNScalar(0), max_distance, num_photons, nearby, distances);
-  if (nearby.NEntries() == 0) {
+// nearby and distances_squared are scratch arrays with room for num_photons entries
+RNRgb EstimateFlux(const PhotonKdtree *photon_map,  R3Point point, int num_photons, RNScalar max_distance, RNRgb diffuseBrdf,
+  const PhotonRecord **nearby, RNLength *distances_squared) {
+  long long nvisited = 0;
+  int num_nearby = photon_map->FindClosest(point, max_distance, num_photons, nearby, distances_squared, &nvisited);
+  StatsCount(STATS_KNN_QUERIES);
+  StatsCount(STATS_KNN_PHOTONS_VISITED, nvisited);
+  if (num_nearby == 0) {
     return RNRgb(0,0,0);
   }
   RNRgb color = RNRgb(0,0,0);
-  int num_nearby = nearby.NEntries();
   for (int i = 0; i < num_nearby; ++i)
   {
    
-    color += (RNScalar(1.0) - (distances[i] /  cone_filter_const)) * nearby[i]->power;
+    color += (RNScalar(1.0) - (sqrt(distances_squared[i]) /  cone_filter_const)) * nearby[i]->Power();
   }
+  // results are a max-heap, so the furthest photon is first; if fewer than num_photons
+  // were found, the whole disk of max_distance was searched (using the furthest one
+  // would divide by a tiny area where only a few photons lie close to the point)
+  RNScalar radius = (num_nearby < num_photons) ? max_distance : sqrt(distances_squared[0]);
   color *= diffuseBrdf;
-  color /= ((RN_PI * distances[num_nearby - 1] * distances[num_nearby - 1]) * (RNScalar(1) - (RNScalar(2)/(3*cone_filter_const))));
-  delete [] distances;
+  color /= ((RN_PI * radius * radius) * (RNScalar(1) - (RNScalar(2)/(3*cone_filter_const))));
   return color;
 }
 
-// initilize photons on light source
-static RNArray<Photon *>  
-GetPhotonsFromLights(R3Scene *scene, long num_photons, bool get_only_caustics)
+// Irradiance precomputation task settings
+struct IrradianceSettings {
+  const PhotonKdtree *photon_map;
+  int stride;
+  int num_photons;
+  RNScalar max_distance;
+  PhotonRecord *irradiance_photons;
+  int nirradiance_photons;
+};
+
+// number of irradiance estimates computed by one parallel task
+static const int irradiance_per_task = 1024;
+
+static void
+PrecomputeIrradianceTask(int task_index, int thread_index, void *data)
+{
+  IrradianceSettings *settings = (IrradianceSettings *) data;
+  std::vector<const PhotonRecord *> nearby(settings->num_photons);
+  std::vector<RNLength> distances_squared(settings->num_photons);
+  int first = task_index * irradiance_per_task;
+  int last = std::min(first + irradiance_per_task, settings->nirradiance_photons);
+  for (int i = first; i < last; i++) {
+    // copy photon and replace its power with the irradiance estimated at its position
+    PhotonRecord *record = &settings->irradiance_photons[i];
+    *record = *(settings->photon_map->Record(i * settings->stride));
+    RNRgb irradiance = EstimateFlux(settings->photon_map, record->Position(), settings->num_photons, settings->max_distance, RNRgb(1,1,1), nearby.data(), distances_squared.data());
+    record->SetPower(irradiance);
+  }
+}
+
+// estimates irradiance at every stride'th photon of the global map in parallel (Christensen '99)
+// and returns them in a map of their own, so render time lookups only need the closest one
+PhotonKdtree *PrecomputeIrradiance(const PhotonKdtree *photon_map, int stride, int num_photons, RNScalar max_distance)
+{
+  IrradianceSettings settings;
+  settings.photon_map = photon_map;
+  settings.stride = std::max(stride, 1);
+  settings.num_photons = num_photons;
+  settings.max_distance = max_distance;
+  settings.nirradiance_photons = (photon_map->NPhotons() + settings.stride - 1) / settings.stride;
+  std::vector<PhotonRecord> irradiance_photons(settings.nirradiance_photons);
+  settings.irradiance_photons = irradiance_photons.data();
+  int ntasks = (settings.nirradiance_photons + irradiance_per_task - 1) / irradiance_per_task;
+  RNParallelFor(ntasks, PrecomputeIrradianceTask, &settings);
+  return new PhotonKdtree(irradiance_photons.data(), settings.nirradiance_photons);
+}
+
+// number of photons emitted and traced by one parallel task
+static const int photons_per_task = 4096;
+
+// random number indices (photons draw random numbers by index so results don't depend on threads);
+// the path of a photon draws the dimensions after those of its emission
+static const unsigned long long emit_random_stream = 1ULL << 41;
+static const unsigned long long caustic_random_stream = 1ULL << 39;
+
+// emits photon i of one light from the occupied cells of its projection map (returns 0 if there are none)
+static int
+EmitPhotonFromLight(R3Scene *scene, R3Light *light, const ProjectionMap& projection_map, const RNRgb& power, long i, bool get_only_caustics, unsigned long long index_offset, Photon *photon, RNRandomGenerator *generator)
+{
+  generator->SetIndex(emit_random_stream + ((get_only_caustics) ? caustic_random_stream : 0) + index_offset + i);
+  RNScalar u = generator->Scalar();
+  RNScalar v = generator->Scalar();
+  RNScalar w = generator->Scalar();
+  RNScalar s, t;
+  if (!projection_map.Sample(get_only_caustics, u, v, w, &s, &t)) return 0;
+  RNScalar p = generator->Scalar();
+  RNScalar q = generator->Scalar();
+  R3Ray ray = LightEmissionRay(scene, light, s, t, p, q);
+
+  photon->direction = ray.Vector();
+  photon->normal = R3Vector(0,0,0);
+  photon->source = ray.Start();
+  photon->position = R3Point(0,0,0); // to initilize position
+  photon->bounces = 0;
+  photon->power = power;
+  return 1;
+}
+
+// builds projection maps of lights once
+static void
+BuildProjectionMaps(R3Scene *scene)
+{
+  if ((int) projection_maps.size() == scene->NLights()) return;
+  projection_maps.resize(scene->NLights());
+  for (int k = 0; k < scene->NLights(); k++) {
+    projection_maps[k].Build(scene, scene->Light(k), projection_map_resolution);
+    if (print_verbose) {
+      printf("Projection map of light %d: %.1f%% of cells see geometry, %.1f%% specular geometry\n", k,
+        100 * projection_maps[k].OccupiedFraction(false), 100 * projection_maps[k].OccupiedFraction(true));
+    }
+  }
+}
+
+// Batch of photons [first, last) of one light, emitted and traced by one parallel task
+struct ShootTask {
+  R3Light *light;
+  const ProjectionMap *projection_map;
+  RNRgb power;
+  long first;
+  long last;
+};
+
+struct ShootSettings {
+  R3Scene *scene;
+  bool is_caustic_map;
+  bool store_direct;
+  unsigned long long index_offset;
+  bool keep_debug_info;
+  std::vector<ShootTask> tasks;
+  PhotonArena *task_photons;
+  std::vector<std::vector<PhotonDebugInfo> > task_debug_info;
+};
+
+static void
+ShootPhotonsTask(int task_index, int thread_index, void *data)
+{
+  ShootSettings *settings = (ShootSettings *) data;
+  const ShootTask& task = settings->tasks[task_index];
+  PhotonArena *task_photons = &settings->task_photons[task_index];
+  std::vector<PhotonDebugInfo> *task_debug_info = (settings->keep_debug_info) ? &settings->task_debug_info[task_index] : NULL;
+  RNScalar russian_roulette_multiplier = RNScalar(1) / 1 - termination_rate;
+  RNRandomGenerator generator(RNRandomScalarSeed());
+
+  // Generate stage of wavefront engine: queue whole batch, then trace it breadth first
+  if (use_wavefront) {
+    std::vector<PhotonPath> paths;
+    paths.reserve(task.last - task.first);
+    for (long i = task.first; i < task.last; i++) {
+      PhotonPath path;
+      if (!EmitPhotonFromLight(settings->scene, task.light, *task.projection_map, task.power, i,
+        settings->is_caustic_map, settings->index_offset, &path.photon, &generator)) break;
+      path.photon.power *= russian_roulette_multiplier;
+      path.ior = camera_index_of_refraction;
+      path.generator = generator;
+      paths.push_back(path);
+    }
+    tracePhotonsWavefront(settings->scene, paths, task_photons, task_debug_info, settings->is_caustic_map, settings->store_direct);
+    return;
+  }
+
+  for (long i = task.first; i < task.last; i++) {
+    // emit photon and follow it right away, so emitted photons are never stored
+    Photon photon_from_light;
+    if (!EmitPhotonFromLight(settings->scene, task.light, *task.projection_map, task.power, i,
+      settings->is_caustic_map, settings->index_offset, &photon_from_light, &generator)) return;
+
+    // N.B we assume that camera is in vaccum
+    photon_from_light.power *= russian_roulette_multiplier;
+    RNScalar ior = camera_index_of_refraction;
+    tracePhoton(settings->scene, &ior, photon_from_light, task_photons, task_debug_info, settings->is_caustic_map, settings->store_direct, &generator);
+  }
+}
+
+// emits num_photons photons from the lights (index_offset selects the random numbers of the first photon) and traces
+// them in parallel batches, storing them in photons (debug fields go to debug_info if not NULL)
+static void
+ShootPhotons(R3Scene *scene, long num_photons, bool is_caustic_map, bool store_direct, unsigned long long index_offset, PhotonArena& photons, std::vector<PhotonDebugInfo> *debug_info)
 {
-  RNArray<Photon *>  photons_from_lights;
   // num_photons is total number of photons emitted from the lights that 
   // intersect with the secne.
 
@@ -1170,158 +1532,167 @@ GetPhotonsFromLights(R3Scene *scene, long num_photons, bool get_only_caustics)
     total_intensity += light->Intensity();
   }
 
-  long photons_per_intesity = (num_photons + num_caustics) / total_intensity;
+  long photons_per_intesity = num_photons / total_intensity;
   RNScalar photon_power = RNScalar(1)/photons_per_intesity;
-
-  // Draw intersection point and normal for some rays
+  BuildProjectionMaps(scene);
+
+  // Split photons of every light into batches
+  ShootSettings settings;
+  settings.scene = scene;
+  settings.is_caustic_map = is_caustic_map;
+  settings.store_direct = store_direct;
+  settings.index_offset = index_offset;
+  settings.keep_debug_info = (debug_info != NULL);
+  long light_first = 0;
   for (int k = 0; k < scene->NLights(); k++) {
     R3Light *light = scene->Light(k);
+    long light_last = light_first + (long) (photons_per_intesity * light->Intensity());
+    for (long first = light_first; first < light_last; first += photons_per_task) {
+      ShootTask task;
+      task.light = light;
+      task.projection_map = &projection_maps[k];
+      // photons only go where the map saw (specular) geometry, so they carry the power of the other cells too
+      task.power = light->Color() * photon_power * projection_maps[k].OccupiedFraction(is_caustic_map);
+      task.first = first;
+      task.last = std::min(first + photons_per_task, light_last);
+      settings.tasks.push_back(task);
+    }
+    light_first = light_last;
+  }
 
-     if (light->ClassID() == R3PointLight::CLASS_ID()) {
-      // Point light case
-      R3PointLight *point_light = (R3PointLight *) light;
-      for (long i = 0; i<photons_per_intesity * point_light->Intensity(); i++) {
-        Photon *curr_photon = new Photon();
-        R3Ray ray;
-        do {
-          double x = 2.0 * RNRandomScalar() - 1;
-          double y = 2.0 * RNRandomScalar() - 1;
-          double z = 2.0 * RNRandomScalar() - 1;
-
-          curr_photon->direction = R3Vector(x, y, z);
-          ray = R3Ray(point_light->Position(), curr_photon->direction);
-          curr_photon->normal = R3Vector(0,0,0);
-          curr_photon->source = point_light->Position();
-          curr_photon->position = R3Point(0,0,0); // to initilize position
-          curr_photon->bounces = 0;
-          curr_photon->power  = point_light->Color() * photon_power;
-        } while (curr_photon->direction.Length() > 1);
-        if (!get_only_caustics || (get_only_caustics && IsRaySpecular(scene, R3Ray(curr_photon->source, curr_photon->direction))))
-        photons_from_lights.Insert(curr_photon);
-      }
-    } else if (light->ClassID() == R3SpotLight::CLASS_ID()) {
-      // Point light case
-      R3SpotLight *spot_light = (R3SpotLight *) light;
-      for (long i = 0; i<photons_per_intesity * spot_light->Intensity(); i++) {
-        Photon *curr_photon = new Photon();
-        R3Ray ray;
-
-        // sample points in the cone defined by cone
-        R3Point position = spot_light->Position();
-        R3Vector central_direction = spot_light->Direction();
-        R3Vector rotation_axis;
-        RNScalar rotation_angle;
-        central_direction.Normalize();
-        getConversionRotation(R3Vector(0,0,1), central_direction, &rotation_angle, &rotation_axis);
-        RNScalar bias_towards_center = 3;
-        do {
-          RNScalar z = pow(RNRandomScalar(), RNScalar(1)/ bias_towards_center);
-          RNScalar alpha = acos(z); // angle between refleccted and ideal specular ray 
-          RNScalar phi = RNRandomScalar() * RN_TWO_PI;
-          RNScalar sin_alpha = sin(alpha);
-          RNScalar x = sin_alpha * cos(phi);
-          RNScalar y = sin_alpha * sin(phi);
-          R3Vector dir = R3Vector(x,y,z);
-          dir.Rotate(rotation_axis, rotation_angle);
-          dir.Normalize();
-
-          curr_photon->direction = dir;
-          ray = R3Ray(spot_light->Position(), curr_photon->direction);
-          curr_photon->normal = R3Vector(0,0,0);
-          curr_photon->source = spot_light->Position();
-          curr_photon->position = R3Point(0,0,0); // to initilize position
-          curr_photon->bounces = 0;
-          curr_photon->power = spot_light->Color() * photon_power;
-        } while (curr_photon->direction.Dot(central_direction) < cos(spot_light->CutOffAngle()));
-        if (!get_only_caustics || (get_only_caustics && IsRaySpecular(scene, R3Ray(curr_photon->source, curr_photon->direction))))
-        photons_from_lights.Insert(curr_photon);
-      }
-    } else if (light->ClassID() == R3DirectionalLight::CLASS_ID()) {
-      // directional light case
-      double radius = scene->BBox().DiagonalRadius();
-      R3Point scene_center = scene->BBox().Centroid();
-      R3DirectionalLight *dir_light = (R3DirectionalLight *) light;
-      R3Vector dir_light_dir = dir_light->Direction();
-      dir_light_dir.Normalize();
-      R3Point dir_light_pos = scene_center - (dir_light_dir * radius);
-      R3Vector axis1;
-      R3Vector axis2;
-      getR3CircleAxes(dir_light_dir, &axis1, &axis2);
-        
-      for (long i = 0; i<photons_per_intesity * dir_light->Intensity(); i++) {
-        Photon *curr_photon = new Photon();
-        R3Ray ray;
-        // sample points  on circle to shoot photons from
-        R3Point source_pos;
-        RNScalar r1;
-        RNScalar r2;
-        do {
-          r1 = (RNRandomScalar() * 2) - 1;
-          r2 = (RNRandomScalar() * 2) - 1;
-        } while(r1 * r1 + r2 * r2 > 1);
-        source_pos = dir_light_pos;
-        source_pos += (r1 * axis1 * radius) + (r2 * axis2 * radius);
-        curr_photon->direction = dir_light_dir;
-        ray = R3Ray(source_pos, curr_photon->direction);
-        curr_photon->normal = R3Vector(0,0,0);
-        curr_photon->source = source_pos;
-        curr_photon->position = R3Point(0,0,0);
-        curr_photon->bounces = 0;
-        curr_photon->power = dir_light->Color() * photon_power;
-        if (!get_only_caustics || (get_only_caustics && IsRaySpecular(scene, R3Ray(curr_photon->source, curr_photon->direction))))
-        photons_from_lights.Insert(curr_photon);
-      }
-    } else if (light->ClassID() == R3AreaLight::CLASS_ID()) {
-      // Point light case
-      R3AreaLight *area_light = (R3AreaLight *) light;
-      R3Vector axis1;
-      R3Vector axis2;
-      getR3CircleAxes(area_light->Direction(), &axis1, &axis2);
-      for (long i = 0; i<photons_per_intesity * area_light->Intensity(); i++) {
-        Photon *curr_photon = new Photon();
-        R3Ray ray;
-        // sample points  on circle to shoot photons from
-        R3Point source_pos;
-        RNScalar r1;
-        RNScalar r2;
-        do {
-          r1 = (RNRandomScalar() * 2) - 1;
-          r2 = (RNRandomScalar() * 2) - 1;
-        } while(r1 * r1 + r2 * r2 > 1);
-        source_pos = area_light->Position();
-        source_pos += (r1 * axis1 * area_light->Radius()) + (r2 * axis2 * area_light->Radius());
-
-        R3Vector rotation_axis;
-        RNScalar rotation_angle;
-        getConversionRotation(R3Vector(0,0,1), area_light->Direction(), &rotation_angle, &rotation_axis);
-        RNScalar z = sqrt(RNRandomScalar());
-        RNScalar phi = RN_TWO_PI * RNRandomScalar();
-        RNScalar theta = acos(z); 
-        RNScalar sin_theta = sin(theta);
-        RNScalar x = sin_theta * cos(phi);
-        RNScalar y = sin_theta * sin(phi);
-        R3Vector dir = R3Vector(x,y,z);
-        dir.Rotate(rotation_axis, rotation_angle);
-        dir.Normalize();
-
-        curr_photon->direction = dir;
-        ray = R3Ray(source_pos, curr_photon->direction);
-        curr_photon->normal = R3Vector(0,0,0);
-        curr_photon->source = source_pos;
-        curr_photon->position = R3Point(0,0,0); 
-        curr_photon->bounces = 0;
-        curr_photon->power = area_light->Color() * photon_power;
-        if (!get_only_caustics || (get_only_caustics && IsRaySpecular(scene, R3Ray(curr_photon->source, curr_photon->direction))))
-        photons_from_lights.Insert(curr_photon);
+  // Emit and trace batches in parallel, each task stores into its own arena
+  int ntasks = (int) settings.tasks.size();
+  settings.task_photons = new PhotonArena [ ntasks ];
+  if (debug_info) settings.task_debug_info.resize(ntasks);
+  RNParallelFor(ntasks, ShootPhotonsTask, &settings);
+
+  // Merge arenas in task order
+  for (int i = 0; i < ntasks; i++) {
+    PhotonArena& task_photons = settings.task_photons[i];
+    if (debug_info) {
+      // Offset debug ids by number of photons merged so far
+      unsigned int first_id = (unsigned int) debug_info->size();
+      for (int k = 0; k < task_photons.NChunks(); k++) {
+        PhotonRecord *chunk_photons = task_photons.ChunkPhotons(k);
+        for (int j = 0; j < task_photons.ChunkSize(k); j++) chunk_photons[j].id += first_id;
       }
-    } else {
-      std::cout << "unrecognized light" << std::endl;
-      assert(false);
-      return photons_from_lights;
-    } 
+      debug_info->insert(debug_info->end(), settings.task_debug_info[i].begin(), settings.task_debug_info[i].end());
+    }
+    photons.Append(task_photons);
+  }
+  delete [] settings.task_photons;
+}
+
+// emits and traces num_photons photons for one progressive pass, storing every diffuse hit (direct ones too)
+// in photons; each pass carries the power of all lights and draws its own random numbers
+void ShootPhotonPass(R3Scene *scene, long num_photons, int pass, PhotonArena& photons)
+{
+  unsigned long long index_offset = (unsigned long long) pass * num_photons;
+  ShootPhotons(scene, num_photons, false, true, index_offset, photons, NULL);
+}
+// writes linear framebuffer to filename (as is for .pfm files, tone mapped otherwise)
+static int
+WriteFramebuffer(const std::vector<RNRgb>& pixels, const char *filename)
+{
+  // Write text copy of pixels for makeimage.py
+  if (write_csv && !WritePixelsCSV(pixels.data(), render_image_width, render_image_height, tone_map_const)) return 0;
+
+  // Write linear radiance
+  const char *extension = strrchr(filename, '.');
+  if (extension && !strcmp(extension, ".pfm")) {
+    StatsBeginPhase(STATS_WRITE_IMAGE);
+    int status = WritePFM(filename, pixels.data(), render_image_width, render_image_height);
+    StatsEndPhase(STATS_WRITE_IMAGE);
+    if (!status) return 0;
+    if (print_verbose) printf("Wrote image to %s ...\n", filename);
+    return 1;
+  }
+
+  // Apply tone mapping and write image
+  StatsBeginPhase(STATS_TONE_MAP);
+  R2Image *image = ToneMapImage(pixels.data(), render_image_width, render_image_height, tone_map_const);
+  StatsEndPhase(STATS_TONE_MAP);
+  if (!image) return 0;
+  StatsBeginPhase(STATS_WRITE_IMAGE);
+  int status = WriteImage(image, filename);
+  StatsEndPhase(STATS_WRITE_IMAGE);
+  delete image;
+  return status;
+}
+
+// hashes data into hash with 64-bit FNV-1a
+static unsigned long long
+HashBytes(unsigned long long hash, const void *data, size_t size)
+{
+  const unsigned char *bytes = (const unsigned char *) data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
   }
-  return photons_from_lights;
+  return hash;
+}
+
+// hashes bytes of file into hash (missing files add nothing)
+static unsigned long long
+HashFile(unsigned long long hash, const char *filename)
+{
+  FILE *fp = fopen(filename, "rb");
+  if (!fp) return hash;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) hash = HashBytes(hash, buffer, n);
+  fclose(fp);
+  return hash;
 }
+
+// hashes scene file into hash, followed by the mesh and scene files its mesh and include
+// commands read (named relative to the scene file, as R3Scene reads them)
+static unsigned long long
+HashSceneFiles(unsigned long long hash, const char *filename)
+{
+  hash = HashFile(hash, filename);
+  FILE *fp = fopen(filename, "r");
+  if (!fp) return hash;
+  char directory[2048];
+  strcpy(directory, filename);
+  char *slash = strrchr(directory, '/');
+  if (slash) *(slash + 1) = '\0';
+  else directory[0] = '\0';
+  char cmd[1024], name[256], path[2048];
+  int m;
+  while (fscanf(fp, "%1023s", cmd) == 1) {
+    if (cmd[0] == '#') {
+      // Comment -- skip to end of line
+      int c;
+      do { c = fgetc(fp); } while ((c != EOF) && (c != '\n'));
+    }
+    else if (!strcmp(cmd, "mesh") && (fscanf(fp, "%d%255s", &m, name) == 2)) {
+      snprintf(path, sizeof(path), "%s%s", directory, name);
+      hash = HashFile(hash, path);
+    }
+    else if (!strcmp(cmd, "include") && (fscanf(fp, "%255s", name) == 1)) {
+      snprintf(path, sizeof(path), "%s%s", directory, name);
+      hash = HashSceneFiles(hash, path);
+    }
+  }
+  fclose(fp);
+  return hash;
+}
+
+// returns key of photon map files: a hash of the scene and the files it reads, and of all parameters that change photons
+static unsigned long long
+PhotonMapKey(const char *scene_name)
+{
+  unsigned long long hash = HashSceneFiles(14695981039346656037ULL, scene_name);
+  long long counts[5] = { num_photons, num_caustics, max_bounces, projection_map_resolution, random_sequence };
+  RNScalar values[3] = { random_seed, termination_rate, camera_index_of_refraction };
+  hash = HashBytes(hash, counts, sizeof(counts));
+  hash = HashBytes(hash, values, sizeof(values));
+  return hash;
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////
 // Main program
 ////////////////////////////////////////////////////////////////////////
@@ -1331,51 +1702,108 @@ int main(int argc, char **argv)
   // Parse program arguments
   if (!ParseArgs(argc, argv)) exit(-1);
 
+  // Initialize random numbers and threads
+  RNSeedRandomScalar(random_seed);
+  RNSetRandomSequence(random_sequence);
+  RNSetNumThreads(num_threads);
 
 
   // Read scene
   std::cout << input_scene_name << std::endl;
+  StatsBeginPhase(STATS_READ_SCENE);
   scene = ReadScene(input_scene_name);
+  StatsEndPhase(STATS_READ_SCENE);
   if (!scene) exit(-1);
 
-  // Initialize photons
-  RNArray<Photon *> photons_from_lights = GetPhotonsFromLights(scene, num_photons, false); //  get_only_caustics  = false
-  RNArray<Photon *> caustics_from_lights = GetPhotonsFromLights(scene, num_caustics, true); //  get_only_caustics = true
+  // Render progressively without keeping a photon map
+  if (sppm_passes > 0) {
+    if (!output_image_name) { fprintf(stderr, "-sppm requires an output image\n"); exit(-1); }
+    scene->SetViewport(R2Viewport(0, 0, render_image_width, render_image_height));
+    std::vector<RNRgb> pixels;
+    StatsBeginPhase(STATS_RENDER);
+    if (!RenderImageSPPM(scene, render_image_width, render_image_height, print_verbose, sppm_passes, sppm_photons, general_search_range, sppm_alpha, time_budget, use_wavefront, pixels)) exit(-1);
+    StatsEndPhase(STATS_RENDER);
+    if (!WriteFramebuffer(pixels, output_image_name)) exit(-1);
+    if (stats_name && !StatsWriteJSON(stats_name, input_scene_name, render_image_width, render_image_height)) exit(-1);
+    return 0;
+  }
 
-  std::cout<<"shooting photons..."<< std::endl;
-  RNScalar russian_roulette_multiplier = RNScalar(1) / 1 - termination_rate;
-  for (int i = 0; i < photons_from_lights.NEntries(); i++) {
-    // N.B we assume that camera is in vaccum
-    Photon *photon_from_light = photons_from_lights[i];
-    photon_from_light->power *= russian_roulette_multiplier;
-    RNScalar ior = camera_index_of_refraction;
-    tracePhoton(scene, &ior, photon_from_light, photon_list, false); // is_caustic_map = false
-  } 
+  // Map photons saved by an earlier run with the same scene and photon parameters
+  unsigned long long photon_map_key = PhotonMapKey(input_scene_name);
+  if (load_photon_map_name) {
+    PhotonKdtree *maps[2] = { NULL, NULL };
+    if (photon_map_file.Open(load_photon_map_name, photon_map_key, 2, maps)) {
+      std::cout<<"loaded photon maps from "<<load_photon_map_name<< std::endl;
+      photon_map = maps[0];
+      caustic_map = maps[1];
+    }
+    else {
+      std::cout<<"no photon maps for this scene and photon parameters in "<<load_photon_map_name<< std::endl;
+    }
+  }
 
-  for (int i = 0; i < caustics_from_lights.NEntries(); i++) {
-    // N.B we assume that camera is in vaccum
-    Photon *caustic_from_light = caustics_from_lights[i];
-    caustic_from_light->power *= russian_roulette_multiplier;
-    RNScalar ior = camera_index_of_refraction;
-    tracePhoton(scene, &ior, caustic_from_light, caustic_list, true); // is_caustic_map = true
-  } 
+  if (!photon_map) {
+    // Aim lights at the scene (photons are emitted in batches while they are traced)
+    StatsBeginPhase(STATS_EMIT_PHOTONS);
+    BuildProjectionMaps(scene);
+    StatsEndPhase(STATS_EMIT_PHOTONS);
+
+    // Store photons compactly (debug fields are only kept for the viewer)
+    std::cout<<"shooting photons..."<< std::endl;
+    bool keep_debug_info = (output_image_name == NULL);
+    PhotonArena photon_arena;
+    PhotonArena caustic_arena;
+    StatsBeginPhase(STATS_TRACE_PHOTONS);
+    ShootPhotons(scene, num_photons + num_caustics, false, false, 0, photon_arena, (keep_debug_info) ? &photon_debug_info : NULL); // is_caustic_map = false
+    ShootPhotons(scene, num_photons + num_caustics, true, false, 0, caustic_arena, (keep_debug_info) ? &caustic_debug_info : NULL); // is_caustic_map = true
+    StatsEndPhase(STATS_TRACE_PHOTONS);
+
+    StatsBeginPhase(STATS_BUILD_KDTREE);
+    photon_map = new PhotonKdtree(photon_arena);
+    caustic_map = new PhotonKdtree(caustic_arena);
+    StatsEndPhase(STATS_BUILD_KDTREE);
+    photon_arena.Empty();
+    caustic_arena.Empty();
+
+    // Save photon maps for later runs
+    if (save_photon_map_name) {
+      const PhotonKdtree *maps[2] = { photon_map, caustic_map };
+      if (!PhotonMapFile::Write(save_photon_map_name, photon_map_key, 2, maps)) exit(-1);
+      std::cout<<"saved photon maps to "<<save_photon_map_name<< std::endl;
+    }
+  }
 
-  photon_map = new R3Kdtree<Photon *>(photon_list, GetPhotonPosition);
-  caustic_map = new R3Kdtree<Photon *>(caustic_list, GetPhotonPosition);
+  if (irradiance_stride > 0) {
+    std::cout<<"precomputing irradiance..."<< std::endl;
+    StatsBeginPhase(STATS_PRECOMPUTE_IRRADIANCE);
+    irradiance_map = PrecomputeIrradiance(photon_map, irradiance_stride, num_photon_estimate, general_search_range * scene->BBox().DiagonalRadius());
+    StatsEndPhase(STATS_PRECOMPUTE_IRRADIANCE);
+  }
   std::cout<<"photon mapping done, now rendering.."<< std::endl;
   // Check output image file
   if (output_image_name) {
     // Set scene viewport
     scene->SetViewport(R2Viewport(0, 0, render_image_width, render_image_height));
     // Render image
-    R2Image *image = RenderImage(scene, photon_map, caustic_map, render_image_width, render_image_height, print_verbose, num_samples, general_search_range,caustic_search_range, tone_map_const, num_photon_estimate);
-    if (!image) exit(-1);
+    std::vector<RNRgb> pixels;
+    std::vector<int> sample_counts;
+    int pixel_max_samples = (max_samples > 0) ? max_samples : 4 * num_samples;
+    StatsBeginPhase(STATS_RENDER);
+    if (!RenderImage(scene, photon_map, caustic_map, irradiance_map, render_image_width, render_image_height, print_verbose, num_samples, target_error, pixel_max_samples, general_search_range,caustic_search_range, num_photon_estimate, pixels, sample_counts)) exit(-1);
+    StatsEndPhase(STATS_RENDER);
 
     // Write image
-    if (!WriteImage(image, output_image_name)) exit(-1);
+    if (!WriteFramebuffer(pixels, output_image_name)) exit(-1);
+
+    // Write samples taken by every pixel
+    if (sample_heatmap_name) {
+      R2Image *heatmap = SampleCountImage(sample_counts.data(), render_image_width, render_image_height, std::max(pixel_max_samples, num_samples));
+      if (!heatmap || !WriteImage(heatmap, sample_heatmap_name)) exit(-1);
+      delete heatmap;
+    }
 
-    // Delete image
-    delete image;
+    // Write statistics
+    if (stats_name && !StatsWriteJSON(stats_name, input_scene_name, render_image_width, render_image_height)) exit(-1);
   }
   else {
     // Initialize GLUT
@@ -1393,13 +1821,8 @@ int main(int argc, char **argv)
   // Delete viewer (doesn't ever get here)
   delete viewer;
   delete photon_map;
-  for (int i = 0; i < photon_list.NEntries(); i++) {
-    delete photon_list[i];
-  }
   delete caustic_map;
-  for (int i = 0; i < caustic_list.NEntries(); i++) {
-    delete caustic_list[i];
-  }
+  delete irradiance_map;
 }
 
 
@@ -3,6 +3,9 @@
 // #ifndef PHOTON_H
 // #define PHOTON_H
 
+#include "photontree.h"
+#include "stats.h"
+
 struct Photon
 {
   R3Vector normal;
@@ -14,8 +17,27 @@ struct Photon
   int bounces;
 }; 
 
-bool traceRayDiffuse(R3Scene *scene, RNScalar *prev_ior, R3Ray ray, R3Point *point, R3SceneElement **element, R3Vector *normal, RNScalar termination_rate_ray_trace, RNRgb *power_multiplier);
+// camera path traced by traceRaysDiffuse until its first diffuse hit
+struct DiffusePath
+{
+  R3Ray ray;
+  RNScalar ior;
+  RNRgb power_multiplier;
+  RNRandomGenerator generator; // random numbers of path, drawn as if it were traced alone
+  bool is_diffuse; // set if path ended at diffuse hit (element, point, normal)
+  R3SceneElement *element;
+  R3Point point;
+  R3Vector normal;
+};
+
+bool traceRayDiffuse(R3Scene *scene, RNScalar *prev_ior, R3Ray ray, R3Point *point, R3SceneElement **element, R3Vector *normal, RNScalar termination_rate_ray_trace, RNRgb *power_multiplier, RNRandomGenerator *generator);
+
+void traceRaysDiffuse(R3Scene *scene, DiffusePath *paths, int npaths, RNScalar termination_rate_ray_trace);
+
+RNRgb EstimateFlux(const PhotonKdtree *photon_map,  R3Point point, int num_photons, RNScalar max_distance, RNRgb diffuseBrdf, const PhotonRecord **nearby, RNLength *distances_squared);
+
+void ShootPhotonPass(R3Scene *scene, long num_photons, int pass, PhotonArena& photons);
 
-RNRgb EstimateFlux(R3Kdtree<Photon *> *photon_map,  R3Point point, int num_photons, RNScalar max_distance, RNRgb diffuseBrdf);
+PhotonKdtree *PrecomputeIrradiance(const PhotonKdtree *photon_map, int stride, int num_photons, RNScalar max_distance);
 
 void getR3CircleAxes(R3Vector normal, R3Vector *axis1, R3Vector *axis2);
@@ -0,0 +1,792 @@
+// Source file for the photon map kd-tree
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Include files
+////////////////////////////////////////////////////////////////////////
+
+#include "R3Graphics/R3Graphics.h"
+#include "photontree.h"
+#include <algorithm>
+#if (RN_OS != RN_WINDOWS)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Photon record functions
+////////////////////////////////////////////////////////////////////////
+
+static_assert(sizeof(PhotonRecord) == 32, "photon records should be 32 bytes");
+
+
+
+void PhotonRecord::
+SetPosition(const R3Point& p)
+{
+  // Set position
+  position[0] = (float) p.X();
+  position[1] = (float) p.Y();
+  position[2] = (float) p.Z();
+}
+
+
+
+static void
+PhotonEncodeVector(const R3Vector& d, unsigned char& theta, unsigned char& phi)
+{
+  // Quantize spherical angles of normalized vector into bytes
+  R3Vector v(d);
+  v.Normalize();
+  RNScalar z = v.Z();
+  if (z > 1) z = 1;
+  else if (z < -1) z = -1;
+  int t = (int) (acos(z) * (256.0 / RN_PI));
+  int p = (int) floor(atan2(v.Y(), v.X()) * (256.0 / RN_TWO_PI));
+  if (t > 255) t = 255;
+  if (p < 0) p += 256;
+  if (p > 255) p = 255;
+  theta = (unsigned char) t;
+  phi = (unsigned char) p;
+}
+
+
+
+void PhotonRecord::
+SetDirection(const R3Vector& d)
+{
+  // Encode incoming direction
+  PhotonEncodeVector(d, theta, phi);
+}
+
+
+
+void PhotonRecord::
+SetNormal(const R3Vector& n)
+{
+  // Encode surface normal
+  PhotonEncodeVector(n, normal_theta, normal_phi);
+}
+
+
+
+void PhotonRecord::
+SetPower(const RNRgb& c)
+{
+  // Encode with shared exponent of largest component (Ward's RGBE)
+  RNScalar v = c.R();
+  if (c.G() > v) v = c.G();
+  if (c.B() > v) v = c.B();
+  if (v < 1.0E-32) {
+    power[0] = power[1] = power[2] = power[3] = 0;
+    return;
+  }
+  int e;
+  frexp(v, &e);
+  RNScalar scale = ldexp(1.0, 8 - e);
+  for (int i = 0; i < 3; i++) {
+    int k = (int) (c[i] * scale + 0.5);
+    if (k < 0) k = 0;
+    else if (k > 255) k = 255;
+    power[i] = (unsigned char) k;
+  }
+  power[3] = (unsigned char) (e + 128);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Memory functions
+////////////////////////////////////////////////////////////////////////
+
+// photon records are allocated on cache line boundaries
+static const size_t photon_alignment = 64;
+
+static PhotonRecord *
+AllocatePhotonRecords(int n)
+{
+  void *data = NULL;
+  size_t size = (n > 0) ? n * sizeof(PhotonRecord) : sizeof(PhotonRecord);
+#if (RN_OS == RN_WINDOWS)
+  data = _aligned_malloc(size, photon_alignment);
+#else
+  if (posix_memalign(&data, photon_alignment, size) != 0) data = NULL;
+#endif
+  if (!data) RNAbort("Unable to allocate %d photon records", n);
+  return (PhotonRecord *) data;
+}
+
+static void
+FreePhotonRecords(PhotonRecord *photons)
+{
+#if (RN_OS == RN_WINDOWS)
+  _aligned_free(photons);
+#else
+  free(photons);
+#endif
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Photon arena functions
+////////////////////////////////////////////////////////////////////////
+
+PhotonArena::
+PhotonArena(void)
+  : nphotons(0)
+{
+}
+
+
+
+PhotonArena::
+~PhotonArena(void)
+{
+  // Release chunks
+  Empty();
+}
+
+
+
+void PhotonArena::
+AddChunk(void)
+{
+  // Allocate empty chunk
+  Chunk chunk;
+  chunk.photons = AllocatePhotonRecords(chunk_size);
+  chunk.nphotons = 0;
+  chunks.push_back(chunk);
+}
+
+
+
+void PhotonArena::
+Append(PhotonArena& arena)
+{
+  // Take over chunks of other arena
+  chunks.insert(chunks.end(), arena.chunks.begin(), arena.chunks.end());
+  nphotons += arena.nphotons;
+  arena.chunks.clear();
+  arena.nphotons = 0;
+}
+
+
+
+void PhotonArena::
+Empty(void)
+{
+  // Release all chunks at once
+  for (int i = 0; i < (int) chunks.size(); i++) {
+    FreePhotonRecords(chunks[i].photons);
+  }
+  chunks.clear();
+  nphotons = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Construction
+////////////////////////////////////////////////////////////////////////
+
+PhotonKdtree::
+PhotonKdtree(const PhotonRecord *input_photons, int nphotons)
+  : photons(NULL),
+    nphotons(nphotons),
+    bbox(R3null_box),
+    owns_photons(TRUE)
+{
+  // Copy photons into working array
+  PhotonRecord *segment = AllocatePhotonRecords(nphotons);
+  for (int i = 0; i < nphotons; i++) {
+    segment[i] = input_photons[i];
+  }
+
+  // Build tree
+  Build(segment);
+}
+
+
+
+PhotonKdtree::
+PhotonKdtree(const PhotonArena& arena)
+  : photons(NULL),
+    nphotons(arena.NPhotons()),
+    bbox(R3null_box),
+    owns_photons(TRUE)
+{
+  // Copy photons from arena chunks into working array
+  PhotonRecord *segment = AllocatePhotonRecords(nphotons);
+  int n = 0;
+  for (int k = 0; k < arena.NChunks(); k++) {
+    memcpy(&segment[n], arena.ChunkPhotons(k), arena.ChunkSize(k) * sizeof(PhotonRecord));
+    n += arena.ChunkSize(k);
+  }
+
+  // Build tree
+  Build(segment);
+}
+
+
+
+PhotonKdtree::
+PhotonKdtree(const PhotonRecord *balanced_photons, int nphotons, const R3Box& bbox)
+  : photons((PhotonRecord *) balanced_photons),
+    nphotons(nphotons),
+    bbox(bbox),
+    owns_photons(FALSE)
+{
+  // Use photons that are already in heap order (they are neither copied nor freed)
+}
+
+
+
+PhotonKdtree::
+~PhotonKdtree(void)
+{
+  // Delete photons
+  if (owns_photons) FreePhotonRecords(photons);
+}
+
+
+
+void PhotonKdtree::
+Build(PhotonRecord *segment)
+{
+  // Compute bounding box
+  for (int i = 0; i < nphotons; i++) {
+    bbox.Union(segment[i].Position());
+  }
+
+  // Allocate heap ordered array and build left-balanced tree
+  photons = AllocatePhotonRecords(nphotons);
+  if (nphotons > 0) BalanceParallel(segment);
+
+  // Delete working array
+  FreePhotonRecords(segment);
+}
+
+
+
+// compares photon positions along one dimension
+struct PhotonRecordLess {
+  PhotonRecordLess(RNDimension dim) : dim(dim) {}
+  bool operator()(const PhotonRecord& a, const PhotonRecord& b) const { return a.position[dim] < b.position[dim]; }
+  RNDimension dim;
+};
+
+
+
+void PhotonKdtree::
+Split(const PhotonKdtreeSegment& segment, PhotonKdtreeSegment children[2])
+{
+  // Compute size of left subtree so the tree is complete (Jensen's median)
+  int nsegment = segment.nphotons;
+  int half = 1;
+  while (4 * half <= nsegment) half += half;
+  int median = (3 * half <= nsegment) ? (half + half - 1) : (nsegment - half);
+
+  // Split along longest dimension of segment box
+  RNDimension dim = segment.box.LongestAxis();
+  std::nth_element(segment.photons, segment.photons + median, segment.photons + nsegment, PhotonRecordLess(dim));
+
+  // Store median photon at this node
+  int index = segment.index;
+  photons[index] = segment.photons[median];
+  photons[index].flags = (unsigned char) ((photons[index].flags & ~PHOTON_SPLIT_DIMENSION_MASK) | dim);
+  RNCoord split = segment.photons[median].position[dim];
+
+  // Return photons of left subtree
+  children[0].photons = segment.photons;
+  children[0].nphotons = median;
+  children[0].index = 2 * index + 1;
+  children[0].box = segment.box;
+  children[0].box[RN_HI][dim] = split;
+
+  // Return photons of right subtree
+  children[1].photons = segment.photons + median + 1;
+  children[1].nphotons = nsegment - median - 1;
+  children[1].index = 2 * index + 2;
+  children[1].box = segment.box;
+  children[1].box[RN_LO][dim] = split;
+}
+
+
+
+void PhotonKdtree::
+Balance(const PhotonKdtreeSegment& segment)
+{
+  // Store median and build both subtrees
+  PhotonKdtreeSegment children[2];
+  Split(segment, children);
+  if (children[0].nphotons > 0) Balance(children[0]);
+  if (children[1].nphotons > 0) Balance(children[1]);
+}
+
+
+
+// subtrees of one level of a parallel build
+struct PhotonKdtreeBuildLevel {
+  PhotonKdtree *tree;
+  std::vector<PhotonKdtreeSegment> segments;
+  std::vector<PhotonKdtreeSegment> children;
+};
+
+// segments smaller than this are balanced by one task
+static const int photon_parallel_build_cutoff = 16384;
+
+
+
+void
+PhotonKdtreeSplitTask(int task_index, int thread_index, void *data)
+{
+  // Store median of one segment and return its two halves
+  PhotonKdtreeBuildLevel *level = (PhotonKdtreeBuildLevel *) data;
+  level->tree->Split(level->segments[task_index], &level->children[2 * task_index]);
+}
+
+
+
+void
+PhotonKdtreeBalanceTask(int task_index, int thread_index, void *data)
+{
+  // Build whole subtree of one segment
+  PhotonKdtreeBuildLevel *level = (PhotonKdtreeBuildLevel *) data;
+  level->tree->Balance(level->segments[task_index]);
+}
+
+
+
+void PhotonKdtree::
+BalanceParallel(PhotonRecord *segment)
+{
+  // Start with all photons at the root
+  PhotonKdtreeBuildLevel level;
+  level.tree = this;
+  PhotonKdtreeSegment root;
+  root.photons = segment;
+  root.nphotons = nphotons;
+  root.index = 0;
+  root.box = bbox;
+  level.segments.push_back(root);
+
+  // Split top levels breadth first, with the nodes of each level in parallel,
+  // until there are a few large subtrees per thread (subtrees write disjoint
+  // ranges of photons, so the tree is the same as one built serially)
+  int max_segments = 4 * RNNumThreads();
+  while ((RNNumThreads() > 1) && ((int) level.segments.size() < max_segments) &&
+         (level.segments[0].nphotons >= photon_parallel_build_cutoff)) {
+    int nsegments = (int) level.segments.size();
+    level.children.resize(2 * nsegments);
+    RNParallelFor(nsegments, PhotonKdtreeSplitTask, &level);
+    level.segments.clear();
+    for (int i = 0; i < 2 * nsegments; i++) {
+      if (level.children[i].nphotons > 0) level.segments.push_back(level.children[i]);
+    }
+    if (level.segments.empty()) return;
+  }
+
+  // Build remaining subtrees in parallel
+  RNParallelFor((int) level.segments.size(), PhotonKdtreeBalanceTask, &level);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Finding the closest K photons
+////////////////////////////////////////////////////////////////////////
+
+// state of one k-nearest neighbor search
+struct PhotonKdtreeQuery {
+  RNCoord position[3];
+  RNLength max_distance_squared;
+  int max_photons;
+  int nfound;
+  int nvisited;
+  const PhotonRecord **photons;
+  RNLength *distances_squared;
+};
+
+
+
+static void
+InsertClosestPhoton(PhotonKdtreeQuery& query, const PhotonRecord *photon, RNLength distance_squared)
+{
+  const PhotonRecord **heap = query.photons;
+  RNLength *keys = query.distances_squared;
+
+  if (query.nfound < query.max_photons) {
+    // Add photon at bottom of heap and sift up
+    int i = query.nfound++;
+    while (i > 0) {
+      int parent = (i - 1) / 2;
+      if (keys[parent] >= distance_squared) break;
+      heap[i] = heap[parent];
+      keys[i] = keys[parent];
+      i = parent;
+    }
+    heap[i] = photon;
+    keys[i] = distance_squared;
+
+    // Shrink search radius once heap is full
+    if (query.nfound == query.max_photons) query.max_distance_squared = keys[0];
+  }
+  else {
+    // Replace furthest photon and sift down
+    int n = query.nfound;
+    int i = 0;
+    while (TRUE) {
+      int child = 2 * i + 1;
+      if (child >= n) break;
+      if ((child + 1 < n) && (keys[child + 1] > keys[child])) child++;
+      if (keys[child] <= distance_squared) break;
+      heap[i] = heap[child];
+      keys[i] = keys[child];
+      i = child;
+    }
+    heap[i] = photon;
+    keys[i] = distance_squared;
+
+    // Shrink search radius to furthest photon found so far
+    query.max_distance_squared = keys[0];
+  }
+}
+
+
+
+static void
+FindClosestPhotons(const PhotonRecord *photons, int nphotons, int index, PhotonKdtreeQuery& query)
+{
+  const PhotonRecord *photon = &photons[index];
+  query.nvisited++;
+
+  // Search children (nearer side first)
+  int left = 2 * index + 1;
+  if (left < nphotons) {
+    RNDimension dim = photon->SplitDimension();
+    RNLength side = query.position[dim] - photon->position[dim];
+    int near_child = (side <= 0) ? left : left + 1;
+    int far_child = (side <= 0) ? left + 1 : left;
+    if (near_child < nphotons) FindClosestPhotons(photons, nphotons, near_child, query);
+    if ((far_child < nphotons) && (side * side < query.max_distance_squared)) {
+      FindClosestPhotons(photons, nphotons, far_child, query);
+    }
+  }
+
+  // Check photon at this node
+  RNLength dx = query.position[0] - photon->position[0];
+  RNLength dy = query.position[1] - photon->position[1];
+  RNLength dz = query.position[2] - photon->position[2];
+  RNLength distance_squared = dx*dx + dy*dy + dz*dz;
+  if (distance_squared <= query.max_distance_squared) {
+    InsertClosestPhoton(query, photon, distance_squared);
+  }
+}
+
+
+
+int PhotonKdtree::
+FindClosest(const R3Point& position, RNLength max_distance, int max_photons,
+  const PhotonRecord **closest_photons, RNLength *distances_squared, long long *nvisited) const
+{
+  // Check tree
+  if ((nphotons == 0) || (max_photons <= 0)) return 0;
+
+  // Search tree from root
+  PhotonKdtreeQuery query;
+  query.position[0] = position.X();
+  query.position[1] = position.Y();
+  query.position[2] = position.Z();
+  query.max_distance_squared = max_distance * max_distance;
+  query.max_photons = max_photons;
+  query.nfound = 0;
+  query.nvisited = 0;
+  query.photons = closest_photons;
+  query.distances_squared = distances_squared;
+  FindClosestPhotons(photons, nphotons, 0, query);
+  if (nvisited) *nvisited += query.nvisited;
+
+  // Return number of photons found
+  return query.nfound;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Finding all photons within some distance
+////////////////////////////////////////////////////////////////////////
+
+// visitor that collects photons in an array
+struct PhotonCollector {
+  PhotonCollector(RNArray<const PhotonRecord *>& found_photons) : found_photons(found_photons) {}
+  void operator()(const PhotonRecord *photon, RNLength distance_squared) { found_photons.Insert(photon); }
+  RNArray<const PhotonRecord *>& found_photons;
+};
+
+
+
+int PhotonKdtree::
+FindAll(const R3Point& position, RNLength max_distance,
+  RNArray<const PhotonRecord *>& found_photons) const
+{
+  // Collect photons visited within max_distance
+  PhotonCollector collector(found_photons);
+  ForEachWithin(position, max_distance, collector);
+  return found_photons.NEntries();
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Finding the closest photon facing some direction
+////////////////////////////////////////////////////////////////////////
+
+// state of one closest facing photon search
+struct PhotonKdtreeFacingQuery {
+  RNCoord position[3];
+  R3Vector normal;
+  RNScalar min_cosine;
+  RNLength max_distance_squared;
+  const PhotonRecord *closest_photon;
+};
+
+
+
+static void
+FindClosestFacingPhoton(const PhotonRecord *photons, int nphotons, int index, PhotonKdtreeFacingQuery& query)
+{
+  const PhotonRecord *photon = &photons[index];
+
+  // Search children (nearer side first)
+  int left = 2 * index + 1;
+  if (left < nphotons) {
+    RNDimension dim = photon->SplitDimension();
+    RNLength side = query.position[dim] - photon->position[dim];
+    int near_child = (side <= 0) ? left : left + 1;
+    int far_child = (side <= 0) ? left + 1 : left;
+    if (near_child < nphotons) FindClosestFacingPhoton(photons, nphotons, near_child, query);
+    if ((far_child < nphotons) && (side * side < query.max_distance_squared)) {
+      FindClosestFacingPhoton(photons, nphotons, far_child, query);
+    }
+  }
+
+  // Check photon at this node (normal is only decoded for closer photons)
+  RNLength dx = query.position[0] - photon->position[0];
+  RNLength dy = query.position[1] - photon->position[1];
+  RNLength dz = query.position[2] - photon->position[2];
+  RNLength distance_squared = dx*dx + dy*dy + dz*dz;
+  if (distance_squared > query.max_distance_squared) return;
+  if (query.normal.Dot(photon->Normal()) < query.min_cosine) return;
+  query.max_distance_squared = distance_squared;
+  query.closest_photon = photon;
+}
+
+
+
+const PhotonRecord *PhotonKdtree::
+FindClosestFacing(const R3Point& position, const R3Vector& normal,
+  RNLength max_distance, RNScalar min_cosine) const
+{
+  // Check tree
+  if (nphotons == 0) return NULL;
+
+  // Search tree from root
+  PhotonKdtreeFacingQuery query;
+  query.position[0] = position.X();
+  query.position[1] = position.Y();
+  query.position[2] = position.Z();
+  query.normal = normal;
+  query.min_cosine = min_cosine;
+  query.max_distance_squared = max_distance * max_distance;
+  query.closest_photon = NULL;
+  FindClosestFacingPhoton(photons, nphotons, 0, query);
+
+  // Return closest photon
+  return query.closest_photon;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Photon map files
+////////////////////////////////////////////////////////////////////////
+
+// header at the start of photon map files
+struct PhotonMapFileHeader {
+  char magic[8];
+  unsigned int version;
+  unsigned int record_size;
+  unsigned long long key;
+  unsigned int nmaps;
+  unsigned int unused;
+  struct {
+    unsigned long long offset;
+    long long nphotons;
+    double bbox[6];
+  } maps[PHOTON_MAP_FILE_MAX_MAPS];
+};
+
+static const char photon_map_file_magic[8] = "PHOTMAP";
+
+
+
+PhotonMapFile::
+PhotonMapFile(void)
+  : data(NULL),
+    size(0)
+#if (RN_OS == RN_WINDOWS)
+    , file_handle(INVALID_HANDLE_VALUE),
+    mapping_handle(NULL)
+#endif
+{
+}
+
+
+
+PhotonMapFile::
+~PhotonMapFile(void)
+{
+  // Unmap file
+  Close();
+}
+
+
+
+int PhotonMapFile::
+Open(const char *filename, unsigned long long key, int nmaps, PhotonKdtree **maps)
+{
+  // Unmap previous file
+  Close();
+
+  // Map file read-only
+#if (RN_OS == RN_WINDOWS)
+  file_handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_handle == INVALID_HANDLE_VALUE) return 0;
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file_handle, &file_size)) { Close(); return 0; }
+  size = (size_t) file_size.QuadPart;
+  if (size < sizeof(PhotonMapFileHeader)) { Close(); return 0; }
+  mapping_handle = CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping_handle) { Close(); return 0; }
+  data = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+  if (!data) { Close(); return 0; }
+#else
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return 0;
+  struct stat file_stat;
+  if ((fstat(fd, &file_stat) != 0) || (file_stat.st_size < (off_t) sizeof(PhotonMapFileHeader))) { close(fd); return 0; }
+  size = (size_t) file_stat.st_size;
+  data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) { data = NULL; size = 0; return 0; }
+#endif
+
+  // Check header
+  const PhotonMapFileHeader *header = (const PhotonMapFileHeader *) data;
+  if (memcmp(header->magic, photon_map_file_magic, sizeof(header->magic)) ||
+      (header->version != PHOTON_MAP_FILE_VERSION) ||
+      (header->record_size != sizeof(PhotonRecord)) ||
+      (header->key != key) || ((int) header->nmaps != nmaps) ||
+      (nmaps > PHOTON_MAP_FILE_MAX_MAPS)) {
+    Close();
+    return 0;
+  }
+
+  // Check that records of every tree are inside file
+  for (int i = 0; i < nmaps; i++) {
+    unsigned long long offset = header->maps[i].offset;
+    long long n = header->maps[i].nphotons;
+    if ((n < 0) || (n > INT_MAX) || (offset % sizeof(PhotonRecord)) ||
+        (offset + n * sizeof(PhotonRecord) > size)) {
+      Close();
+      return 0;
+    }
+  }
+
+  // Create trees of mapped photons
+  for (int i = 0; i < nmaps; i++) {
+    const double *b = header->maps[i].bbox;
+    R3Box bbox(b[0], b[1], b[2], b[3], b[4], b[5]);
+    const PhotonRecord *photons = (const PhotonRecord *) ((const char *) data + header->maps[i].offset);
+    maps[i] = new PhotonKdtree(photons, (int) header->maps[i].nphotons, bbox);
+  }
+
+  // Return success
+  return 1;
+}
+
+
+
+void PhotonMapFile::
+Close(void)
+{
+  // Unmap file
+#if (RN_OS == RN_WINDOWS)
+  if (data) UnmapViewOfFile(data);
+  if (mapping_handle) CloseHandle(mapping_handle);
+  if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+  mapping_handle = NULL;
+  file_handle = INVALID_HANDLE_VALUE;
+#else
+  if (data) munmap(data, size);
+#endif
+  data = NULL;
+  size = 0;
+}
+
+
+
+int PhotonMapFile::
+Write(const char *filename, unsigned long long key, int nmaps, const PhotonKdtree *const *maps)
+{
+  // Check number of maps
+  if ((nmaps < 0) || (nmaps > PHOTON_MAP_FILE_MAX_MAPS)) return 0;
+
+  // Fill header (records of each tree start on a cache line)
+  PhotonMapFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, photon_map_file_magic, sizeof(header.magic));
+  header.version = PHOTON_MAP_FILE_VERSION;
+  header.record_size = sizeof(PhotonRecord);
+  header.key = key;
+  header.nmaps = nmaps;
+  unsigned long long offset = sizeof(header);
+  for (int i = 0; i < nmaps; i++) {
+    offset = (offset + photon_alignment - 1) / photon_alignment * photon_alignment;
+    const R3Box& bbox = maps[i]->BBox();
+    header.maps[i].offset = offset;
+    header.maps[i].nphotons = maps[i]->NPhotons();
+    for (int j = 0; j < 6; j++) header.maps[i].bbox[j] = bbox[j / 3][j % 3];
+    offset += maps[i]->NPhotons() * sizeof(PhotonRecord);
+  }
+
+  // Open file
+  FILE *fp = fopen(filename, "wb");
+  if (!fp) {
+    fprintf(stderr, "Unable to open photon map file %s\n", filename);
+    return 0;
+  }
+
+  // Write header and records
+  int status = (fwrite(&header, sizeof(header), 1, fp) == 1);
+  long long position = sizeof(header);
+  static const char padding[photon_alignment] = { 0 };
+  for (int i = 0; status && (i < nmaps); i++) {
+    int npadding = (int) (header.maps[i].offset - position);
+    if ((npadding > 0) && (fwrite(padding, 1, npadding, fp) != (size_t) npadding)) status = 0;
+    int n = maps[i]->NPhotons();
+    if ((n > 0) && (fwrite(maps[i]->Record(0), sizeof(PhotonRecord), n, fp) != (size_t) n)) status = 0;
+    position = header.maps[i].offset + (long long) n * sizeof(PhotonRecord);
+  }
+
+  // Close file
+  if (fclose(fp) != 0) status = 0;
+  if (!status) fprintf(stderr, "Unable to write photon map file %s\n", filename);
+  return status;
+}
@@ -0,0 +1,304 @@
+// Include file for the photon map kd-tree
+
+#ifndef __PHOTONTREE__H__
+#define __PHOTONTREE__H__
+
+#include <vector>
+
+
+
+// Photon record stored in the photon map
+
+// Low bits of PhotonRecord::flags hold the split dimension of the kd-tree node
+#define PHOTON_SPLIT_DIMENSION_MASK 0x3
+
+// Records are 32 bytes (two per cache line).  Power is stored with a shared
+// exponent (Ward's RGBE) and the incoming direction and surface normal as
+// quantized spherical angles.  Only what rendering needs is kept here; id is
+// the index of the photon in the optional debug side table.
+
+struct PhotonRecord
+{
+  // Access functions
+  R3Point Position(void) const { return R3Point(position[0], position[1], position[2]); }
+  R3Vector Direction(void) const;
+  R3Vector Normal(void) const;
+  RNRgb Power(void) const;
+  RNDimension SplitDimension(void) const { return flags & PHOTON_SPLIT_DIMENSION_MASK; }
+
+  // Manipulation functions
+  void SetPosition(const R3Point& position);
+  void SetDirection(const R3Vector& direction);
+  void SetNormal(const R3Vector& normal);
+  void SetPower(const RNRgb& power);
+
+  // Record data
+  float position[3];
+  unsigned int id;
+  unsigned char power[4];
+  unsigned char theta;
+  unsigned char phi;
+  unsigned char flags;
+  unsigned char normal_theta;
+  unsigned char normal_phi;
+  unsigned char unused[7];
+};
+
+
+
+// Debugging information for a stored photon (only used for drawing)
+
+struct PhotonDebugInfo
+{
+  R3Point source;
+  R3Vector normal;
+  R3Vector out_direction;
+};
+
+
+
+// Inline functions
+
+inline RNRgb PhotonRecord::
+Power(void) const
+{
+  // Decode shared exponent
+  if (power[3] == 0) return RNRgb(0, 0, 0);
+  RNScalar scale = ldexp(1.0, (int) power[3] - (128 + 8));
+  return RNRgb(power[0] * scale, power[1] * scale, power[2] * scale);
+}
+
+
+
+inline R3Vector
+PhotonDecodeVector(unsigned char theta, unsigned char phi)
+{
+  // Decode spherical angles
+  RNAngle t = (theta + 0.5) * (RN_PI / 256.0);
+  RNAngle p = (phi + 0.5) * (RN_TWO_PI / 256.0);
+  RNScalar sin_t = sin(t);
+  return R3Vector(sin_t * cos(p), sin_t * sin(p), cos(t));
+}
+
+
+
+inline R3Vector PhotonRecord::
+Direction(void) const
+{
+  // Decode incoming direction
+  return PhotonDecodeVector(theta, phi);
+}
+
+
+
+inline R3Vector PhotonRecord::
+Normal(void) const
+{
+  // Decode surface normal
+  return PhotonDecodeVector(normal_theta, normal_phi);
+}
+
+
+
+// Photon arena class
+
+// Stored photons are bump-allocated from fixed-size chunks, which are only
+// released all at once.  Appending an arena to another hands over its chunks
+// without copying photons.
+
+class PhotonArena {
+public:
+  // Constructor/destructors
+  PhotonArena(void);
+  ~PhotonArena(void);
+
+  // Property functions
+  int NPhotons(void) const { return nphotons; }
+  int NChunks(void) const { return (int) chunks.size(); }
+  PhotonRecord *ChunkPhotons(int k) const { return chunks[k].photons; }
+  int ChunkSize(int k) const { return chunks[k].nphotons; }
+
+  // Manipulation functions
+  PhotonRecord *Allocate(void);
+  void Append(PhotonArena& arena);
+  void Empty(void);
+
+  // Number of photons per chunk
+  static const int chunk_size = 4096;
+
+private:
+  // Arenas own their chunks
+  PhotonArena(const PhotonArena& arena);
+  PhotonArena& operator=(const PhotonArena& arena);
+  void AddChunk(void);
+
+  struct Chunk { PhotonRecord *photons; int nphotons; };
+  std::vector<Chunk> chunks;
+  int nphotons;
+};
+
+
+
+inline PhotonRecord *PhotonArena::
+Allocate(void)
+{
+  // Start new chunk if last one is full
+  if (chunks.empty() || (chunks.back().nphotons == chunk_size)) AddChunk();
+  nphotons++;
+  return &chunks.back().photons[chunks.back().nphotons++];
+}
+
+
+
+// Photons of one subtree during construction
+
+struct PhotonKdtreeSegment {
+  PhotonRecord *photons;
+  int nphotons;
+  int index; // position of subtree root in heap order
+  R3Box box;
+};
+
+
+
+// Photon map kd-tree class
+
+// Photons are stored in one contiguous, cache-aligned array as a left-balanced
+// kd-tree (Jensen 2001): the children of the photon at index i are at 2i+1 and
+// 2i+2, and each record holds the dimension of its splitting plane, so there
+// are no child pointers and no per-node allocations.  Each node is split at
+// its median with nth_element; the top levels are split in parallel and the
+// subtrees below them are built by parallel tasks.
+
+class PhotonKdtree {
+public:
+  // Constructor/destructors
+  PhotonKdtree(const PhotonRecord *photons, int nphotons);
+  PhotonKdtree(const PhotonArena& photons);
+  PhotonKdtree(const PhotonRecord *balanced_photons, int nphotons, const R3Box& bbox);
+  ~PhotonKdtree(void);
+
+  // Property functions
+  const R3Box& BBox(void) const { return bbox; }
+  int NPhotons(void) const { return nphotons; }
+  const PhotonRecord *Record(int k) const { return &photons[k]; }
+
+  // Search for closest K photons within max_distance.  Results are written
+  // to caller-supplied arrays with room for max_photons entries and are kept
+  // as a max-heap, so distances_squared[0] is the distance to the furthest one.
+  // The number of photons visited is added to nvisited if it is not NULL.
+  int FindClosest(const R3Point& position, RNLength max_distance, int max_photons,
+    const PhotonRecord **closest_photons, RNLength *distances_squared, long long *nvisited = NULL) const;
+
+  // Search for all photons within max_distance
+  int FindAll(const R3Point& position, RNLength max_distance,
+    RNArray<const PhotonRecord *>& found_photons) const;
+
+  // Call visitor(photon, distance_squared) for all photons within max_distance
+  // as the tree is traversed, so estimates need no array of found photons
+  template <class Visitor>
+  void ForEachWithin(const R3Point& position, RNLength max_distance, Visitor& visitor) const;
+
+  // Search for closest photon within max_distance whose normal is within
+  // acos(min_cosine) of normal (NULL if there is none)
+  const PhotonRecord *FindClosestFacing(const R3Point& position, const R3Vector& normal,
+    RNLength max_distance, RNScalar min_cosine) const;
+
+private:
+  // Build functions (the parallel build tasks split and balance segments)
+  friend void PhotonKdtreeSplitTask(int task_index, int thread_index, void *data);
+  friend void PhotonKdtreeBalanceTask(int task_index, int thread_index, void *data);
+  void Build(PhotonRecord *segment);
+  void BalanceParallel(PhotonRecord *segment);
+  void Balance(const PhotonKdtreeSegment& segment);
+  void Split(const PhotonKdtreeSegment& segment, PhotonKdtreeSegment children[2]);
+
+  // Tree data
+  PhotonRecord *photons;
+  int nphotons;
+  R3Box bbox;
+  RNBoolean owns_photons;
+};
+
+
+
+// Inline functions
+
+template <class Visitor>
+inline void
+PhotonKdtreeForEachWithin(const PhotonRecord *photons, int nphotons, int index,
+  const R3Point& position, RNLength max_distance_squared, Visitor& visitor)
+{
+  const PhotonRecord *photon = &photons[index];
+
+  // Visit children that overlap sphere
+  int left = 2 * index + 1;
+  if (left < nphotons) {
+    RNDimension dim = photon->SplitDimension();
+    RNLength side = position[dim] - photon->position[dim];
+    if ((side <= 0) || (side * side <= max_distance_squared)) {
+      PhotonKdtreeForEachWithin(photons, nphotons, left, position, max_distance_squared, visitor);
+    }
+    if ((left + 1 < nphotons) && ((side >= 0) || (side * side <= max_distance_squared))) {
+      PhotonKdtreeForEachWithin(photons, nphotons, left + 1, position, max_distance_squared, visitor);
+    }
+  }
+
+  // Visit photon at this node
+  RNLength distance_squared = R3SquaredDistance(position, photon->Position());
+  if (distance_squared <= max_distance_squared) visitor(photon, distance_squared);
+}
+
+
+
+template <class Visitor>
+inline void PhotonKdtree::
+ForEachWithin(const R3Point& position, RNLength max_distance, Visitor& visitor) const
+{
+  // Visit tree from root
+  if (nphotons == 0) return;
+  PhotonKdtreeForEachWithin(photons, nphotons, 0, position, max_distance * max_distance, visitor);
+}
+
+
+
+// Photon map file class
+
+// Built photon maps are saved with a versioned header and key (a hash of the
+// scene and photon parameters) followed by the records of each tree in heap
+// order.  Opening a file maps it read-only, so trees point straight into the
+// mapping and processes rendering from the same file share its pages.
+
+#define PHOTON_MAP_FILE_VERSION 2
+#define PHOTON_MAP_FILE_MAX_MAPS 4
+
+class PhotonMapFile {
+public:
+  // Constructor/destructors
+  PhotonMapFile(void);
+  ~PhotonMapFile(void);
+
+  // Map file and create its trees (which must be deleted before the file is closed),
+  // returns 0 if the file cannot be read or has another version, key, or number of maps
+  int Open(const char *filename, unsigned long long key, int nmaps, PhotonKdtree **maps);
+  void Close(void);
+
+  // Write trees to file
+  static int Write(const char *filename, unsigned long long key, int nmaps, const PhotonKdtree *const *maps);
+
+private:
+  // Files are mapped for the lifetime of the object
+  PhotonMapFile(const PhotonMapFile& file);
+  PhotonMapFile& operator=(const PhotonMapFile& file);
+
+  void *data;
+  size_t size;
+#if (RN_OS == RN_WINDOWS)
+  HANDLE file_handle;
+  HANDLE mapping_handle;
+#endif
+};
+
+
+
+#endif
@@ -0,0 +1,208 @@
+// Source file for light projection maps
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Include files
+////////////////////////////////////////////////////////////////////////
+
+#include "R3Graphics/R3Graphics.h"
+#include "photonmap.h"
+#include "projectionmap.h"
+#include <iostream>
+#include <algorithm>
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Emission rays
+////////////////////////////////////////////////////////////////////////
+
+// defined in photonmap.cpp
+void getConversionRotation(R3Vector a, R3Vector b, RNScalar *rotation_angle, R3Vector *rotation_axis);
+
+// spot light directions have density cos^(bias - 1) about the spot direction
+static const RNScalar spot_bias_towards_center = 3;
+
+
+
+static R3Vector
+RotatedDirection(RNScalar z, RNScalar phi, R3Vector axis_direction)
+{
+  // Return direction at cosine z and azimuth phi about axis_direction
+  RNScalar r = sqrt(std::max(RNScalar(0), 1 - z * z));
+  R3Vector direction(r * cos(phi), r * sin(phi), z);
+  R3Vector rotation_axis;
+  RNScalar rotation_angle;
+  axis_direction.Normalize();
+  getConversionRotation(R3Vector(0,0,1), axis_direction, &rotation_angle, &rotation_axis);
+  direction.Rotate(rotation_axis, rotation_angle);
+  direction.Normalize();
+  return direction;
+}
+
+
+
+R3Ray
+LightEmissionRay(R3Scene *scene, R3Light *light, RNScalar s, RNScalar t, RNScalar p, RNScalar q)
+{
+  RNScalar phi = RN_TWO_PI * t;
+  if (light->ClassID() == R3PointLight::CLASS_ID()) {
+    // Uniform direction on sphere
+    R3PointLight *point_light = (R3PointLight *) light;
+    RNScalar z = 1 - 2 * s;
+    RNScalar r = sqrt(std::max(RNScalar(0), 1 - z * z));
+    return R3Ray(point_light->Position(), R3Vector(r * cos(phi), r * sin(phi), z));
+  }
+  else if (light->ClassID() == R3SpotLight::CLASS_ID()) {
+    // Direction within cutoff angle, biased towards center of cone
+    R3SpotLight *spot_light = (R3SpotLight *) light;
+    RNScalar min_z = std::max(RNScalar(0), cos(spot_light->CutOffAngle()));
+    RNScalar min_z_power = pow(min_z, spot_bias_towards_center);
+    RNScalar z = pow(min_z_power + s * (1 - min_z_power), 1 / spot_bias_towards_center);
+    return R3Ray(spot_light->Position(), RotatedDirection(z, phi, spot_light->Direction()));
+  }
+  else if (light->ClassID() == R3DirectionalLight::CLASS_ID()) {
+    // Uniform point on disk covering scene bounding sphere, facing along light direction
+    R3DirectionalLight *dir_light = (R3DirectionalLight *) light;
+    RNLength radius = scene->BBox().DiagonalRadius();
+    R3Vector direction = dir_light->Direction();
+    direction.Normalize();
+    R3Vector axis1, axis2;
+    getR3CircleAxes(direction, &axis1, &axis2);
+    RNLength r = radius * sqrt(s);
+    R3Point source = scene->BBox().Centroid() - direction * radius;
+    source += (r * cos(phi)) * axis1 + (r * sin(phi)) * axis2;
+    return R3Ray(source, direction);
+  }
+  else if (light->ClassID() == R3AreaLight::CLASS_ID()) {
+    // Uniform point on light disk and cosine weighted direction
+    R3AreaLight *area_light = (R3AreaLight *) light;
+    R3Vector axis1, axis2;
+    getR3CircleAxes(area_light->Direction(), &axis1, &axis2);
+    RNLength r = area_light->Radius() * sqrt(p);
+    RNAngle source_phi = RN_TWO_PI * q;
+    R3Point source = area_light->Position() + (r * cos(source_phi)) * axis1 + (r * sin(source_phi)) * axis2;
+    return R3Ray(source, RotatedDirection(sqrt(s), phi, area_light->Direction()));
+  }
+  else {
+    std::cout << "unrecognized light" << std::endl;
+    assert(false);
+    return R3Ray(R3zero_point, R3posz_vector);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Projection map construction
+////////////////////////////////////////////////////////////////////////
+
+// cell flags
+#define PROJECTION_MAP_GEOMETRY 0x1
+#define PROJECTION_MAP_SPECULAR 0x2
+
+// sample rays per cell are jittered on a grid of this size (area lights also draw a random
+// emission point for each, so an object seen only from part of the light needs several)
+static const int projection_map_samples_per_side = 4;
+
+// random number index of first cell (so maps don't share random numbers with photons)
+static const unsigned long long projection_map_random_stream = 1ULL << 44;
+
+
+
+ProjectionMap::
+ProjectionMap(void)
+  : resolution(0)
+{
+}
+
+
+
+void ProjectionMap::
+Build(R3Scene *scene, R3Light *light, int resolution)
+{
+  // Empty map
+  geometry_cells.clear();
+  specular_cells.clear();
+
+  // Use one cell that is always occupied if there is no grid
+  if (resolution <= 0) {
+    this->resolution = 1;
+    geometry_cells.push_back(0);
+    specular_cells.push_back(0);
+    return;
+  }
+
+  // Flag cells hit by jittered sample rays
+  this->resolution = resolution;
+  int ncells = resolution * resolution;
+  std::vector<unsigned char> flags(ncells, 0);
+  RNRandomGenerator generator(RNRandomScalarSeed());
+  const int n = projection_map_samples_per_side;
+  for (int i = 0; i < resolution; i++) {
+    for (int j = 0; j < resolution; j++) {
+      generator.SetIndex(projection_map_random_stream + i * resolution + j);
+      for (int k = 0; k < n * n; k++) {
+        RNScalar s = (i + (k / n + generator.Scalar()) / n) / resolution;
+        RNScalar t = (j + (k % n + generator.Scalar()) / n) / resolution;
+        RNScalar p = generator.Scalar();
+        RNScalar q = generator.Scalar();
+        R3SceneElement *element = NULL;
+        if (!scene->Intersects(LightEmissionRay(scene, light, s, t, p, q), NULL, &element)) continue;
+        const R3Material *material = (element) ? element->Material() : &R3default_material;
+        const R3Brdf *brdf = (material) ? material->Brdf() : &R3default_brdf;
+        flags[i * resolution + j] |= PROJECTION_MAP_GEOMETRY;
+        if (!brdf->Specular().IsBlack() || !brdf->Transmission().IsBlack()) {
+          flags[i * resolution + j] |= PROJECTION_MAP_SPECULAR;
+        }
+      }
+    }
+  }
+
+  // Collect cells next to flagged ones (t is an angle, so it wraps around)
+  for (int i = 0; i < resolution; i++) {
+    for (int j = 0; j < resolution; j++) {
+      unsigned char cell_flags = 0;
+      for (int di = -1; di <= 1; di++) {
+        if ((i + di < 0) || (i + di >= resolution)) continue;
+        for (int dj = -1; dj <= 1; dj++) {
+          cell_flags |= flags[(i + di) * resolution + (j + dj + resolution) % resolution];
+        }
+      }
+      if (cell_flags & PROJECTION_MAP_GEOMETRY) geometry_cells.push_back(i * resolution + j);
+      if (cell_flags & PROJECTION_MAP_SPECULAR) specular_cells.push_back(i * resolution + j);
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Sampling
+////////////////////////////////////////////////////////////////////////
+
+RNScalar ProjectionMap::
+OccupiedFraction(bool specular) const
+{
+  // Return fraction of (s, t) covered by occupied cells
+  if (resolution == 0) return 0;
+  return (RNScalar) NOccupiedCells(specular) / (resolution * resolution);
+}
+
+
+
+int ProjectionMap::
+Sample(bool specular, RNScalar u, RNScalar v, RNScalar w, RNScalar *s, RNScalar *t) const
+{
+  // Pick occupied cell
+  const std::vector<int>& cells = (specular) ? specular_cells : geometry_cells;
+  int ncells = (int) cells.size();
+  if (ncells == 0) return 0;
+  int cell = cells[std::min((int) (u * ncells), ncells - 1)];
+
+  // Return uniform point in cell
+  *s = ((cell / resolution) + v) / resolution;
+  *t = ((cell % resolution) + w) / resolution;
+  return 1;
+}
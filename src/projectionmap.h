@@ -0,0 +1,55 @@
+// Include file for light projection maps
+
+#ifndef __PROJECTIONMAP__H__
+#define __PROJECTIONMAP__H__
+
+#include <vector>
+
+
+
+// Emission rays of every light are parameterized by two numbers (s, t) in
+// [0,1)^2, mapped so that uniform (s, t) reproduce the light's own emission
+// distribution: directions for point, spot and area lights, and points on the
+// disk covering the scene for directional lights.  Area lights draw their
+// emission point on the light separately from (p, q).
+
+R3Ray LightEmissionRay(R3Scene *scene, R3Light *light, RNScalar s, RNScalar t, RNScalar p = 0.5, RNScalar q = 0.5);
+
+
+
+// Projection map class
+
+// A coarse grid over (s, t) marks the cells whose sample rays hit any
+// geometry, and separately specular or transmissive geometry (Jensen 1996).
+// Cells are dilated by one so small objects between sample rays are kept.
+// Photons are emitted from occupied cells only, uniformly in (s, t), so their
+// power is scaled by the fraction of cells that are occupied.  This is only
+// unbiased if every cell that can reach geometry is marked: an object small
+// enough to slip between the sample rays of a cell and its neighbors (or, for
+// area lights, between their emission points) gets no photons from it.
+
+class ProjectionMap {
+public:
+  // Constructor functions
+  ProjectionMap(void);
+
+  // Build map with resolution x resolution cells (0 means one cell that is always occupied)
+  void Build(R3Scene *scene, R3Light *light, int resolution);
+
+  // Property functions
+  int Resolution(void) const { return resolution; }
+  int NOccupiedCells(bool specular) const { return (int) ((specular) ? specular_cells : geometry_cells).size(); }
+  RNScalar OccupiedFraction(bool specular) const;
+
+  // Map random numbers u, v, w to (s, t) in a random occupied cell (returns 0 if there is none)
+  int Sample(bool specular, RNScalar u, RNScalar v, RNScalar w, RNScalar *s, RNScalar *t) const;
+
+private:
+  int resolution;
+  std::vector<int> geometry_cells;
+  std::vector<int> specular_cells;
+};
+
+
+
+#endif
@@ -10,12 +10,11 @@
 
 #include "R3Graphics/R3Graphics.h"
 #include <iostream>
-#include "photonmap.h"
+#include "render.h"
 #include <vector>
 #include <algorithm>
-#include <fstream>
-#include <string> 
-#include <chrono>
+#include <atomic>
+#include <mutex>
 
 
 
@@ -29,267 +28,454 @@ static RNScalar camera_index_of_refraction = 1.0;
 // Function to render image with photon mapping
 ////////////////////////////////////////////////////////////////////////
 
-// rgb to grayscale consts
-R3Matrix gray_conv_matrix = R3Matrix(1.0, 0.956, 0.621, 1.0, -0.272, -0.647, 1.0, -1.106, 1.703).Inverse();
-R3Vector gray_conv_coeffs =  R3Vector(gray_conv_matrix[0][0], gray_conv_matrix[0][1], gray_conv_matrix[0][2]);
-
-R2Image *
-RenderImage(R3Scene *scene,
-  R3Kdtree<Photon *> *photon_map,
-  R3Kdtree<Photon *> *caustic_map,
-  int width,
-  int height,
-  int print_verbose,
-  int num_samples,
-  RNScalar max_estimate_dist_proportion_global,
-  RNScalar max_estimate_dist_proportion_caustic,
-  RNScalar reinhard_tone_map_a,
-  int num_photon_estimate)
-
+// Photon map render settings shared by all tiles
+struct RenderSettings {
+  R3Scene *scene;
+  PhotonKdtree *photon_map;
+  PhotonKdtree *caustic_map;
+  PhotonKdtree *irradiance_map;
+  int width;
+  int height;
+  int num_samples;
+  RNScalar target_error;
+  int max_samples;
+  int pilot_samples;
+  int sample_stride;
+  RNScalar max_estimate_dist_global;
+  RNScalar max_estimate_dist_caustic;
+  int num_photon_estimate;
+  RNScalar roulette_multiplier;
+  std::vector<R3Vector> axes1;
+  std::vector<R3Vector> axes2;
+  int ntiles_x;
+  int ntiles_y;
+  RNRgb *pixels;
+  int *sample_counts;
+  RNScalar *pilot_means;
+  RNScalar *pilot_variances;
+  std::atomic<int> num_rendered_pixels;
+  std::mutex print_mutex;
+};
+
+// size of square image tiles rendered as one task
+static const int render_tile_size = 16;
+
+// smallest cosine between normals of a shaded point and the photon whose irradiance it uses
+static const RNScalar irradiance_normal_cosine = 0.9;
+
+// random number index of first pixel sample (so pixels don't share random numbers with photons)
+static const unsigned long long render_random_stream = 1ULL << 40;
+
+// adaptive sampling spends this fraction of the samples on pilot samples, at least the minimum
+// per pixel (two, so they have a variance)
+static const int adaptive_pilot_divisor = 8;
+static const int adaptive_min_pilot_samples = 2;
+
+// relative errors of adaptive sampling are measured against pixel luminance plus this fraction of the
+// mean image luminance, so noisy pixels that are nearly black do not take the whole budget
+static const RNScalar adaptive_luminance_floor = 1.0;
+
+// pilot statistics are averaged over pixels at most this far apart, since a few samples give a noisy variance
+static const int adaptive_filter_radius = 3;
+
+
+
+static RNRgb
+RenderSample(RenderSettings *settings, int i, int j, int s, RNRandomGenerator *generator,
+  const PhotonRecord **nearby, RNLength *distances_squared)
 {
-  assert(photon_map);
-  assert(caustic_map);
-
-  // Start statistics
-  RNTime start_time;
-  start_time.Read();
-  int ray_count = 0;
-  // Allocate image
-  R2Image *image = new R2Image(width, height);
-  if (!image) {
-    fprintf(stderr, "Unable to allocate image\n");
-    return NULL;
-  }
+  R3Scene *scene = settings->scene;
   R3SceneElement *element;
   R3Point point;
   R3Vector normal;
-  RNScalar roulette_multiplier = RNScalar(1)/ 1 - termination_rate; // becuase of russian roulette
-  int num_rendered_pixels = 0;
-  int total_pixels = width * height;
-  std::vector<RNRgb> pixels;
-
-  // precompute axes for area lights
-  R3Vector axes1[scene->NLights()];
-  R3Vector axes2[scene->NLights()];
-  for (int k = 0; k < scene->NLights(); k++) {
-    R3Light *light = scene->Light(k);
-    if (light->ClassID() == R3AreaLight::CLASS_ID()) {
-      R3AreaLight *area_light = (R3AreaLight *) light;
-      getR3CircleAxes(area_light->Direction(), &axes1[k], &axes2[k]);
-    }
+  RNScalar roulette_multiplier = settings->roulette_multiplier;
+  RNRgb color = RNRgb(0,0,0);
+
+  // draw random numbers by pixel sample so the result does not depend on the thread, tile order or number of samples taken
+  unsigned long long pixel_index = (unsigned long long) i * settings->height + j;
+  generator->SetIndex(render_random_stream + pixel_index * settings->sample_stride + s);
+  RNScalar jitter_x = generator->Scalar() - 0.5;
+  RNScalar jitter_y = generator->Scalar() - 0.5;
+  R3Ray ray = scene->Viewer().WorldRay(i + jitter_x, j + jitter_y);
+  StatsCount(STATS_PRIMARY_RAYS);
+  // std::cout<<ray.Point(0)[0]<< ", " << ray.Point(0)[1] << ", " << ray.Point(0)[2] <<std::endl;
+
+  RNScalar prev_ior = camera_index_of_refraction;
+  RNRgb power_multiplier =  RNRgb(1,1,1);
+  if (!traceRayDiffuse(scene, &prev_ior, ray, &point, &element, &normal, termination_rate, &power_multiplier, generator)) {
+    return color;
   }
-  // Draw intersection point and normal for some rays
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      RNRgb color = RNRgb(0,0,0);
+  normal.Normalize();
+  // add indirect lighting contribution with photon map
 
-      for (int s = 0; s < num_samples; s ++) {
-        R3Ray ray = scene->Viewer().WorldRay(i, j);
-        // std::cout<<ray.Point(0)[0]<< ", " << ray.Point(0)[1] << ", " << ray.Point(0)[2] <<std::endl;
+  const R3Material *material = (element) ? element->Material() : &R3default_material;
+  const R3Brdf *brdf = (material) ? material->Brdf() : &R3default_brdf;
 
-        RNScalar prev_ior = camera_index_of_refraction;
-        RNRgb power_multiplier =  RNRgb(1,1,1);
-        if (!traceRayDiffuse(scene, &prev_ior, ray, &point, &element, &normal, termination_rate, &power_multiplier)) {
+  //power_multiplier =  brdf->Diffuse();
+  //std::cout<<power_multiplier[0]<< ", " << power_multiplier[1] << ", " << power_multiplier[2] <<std::endl;
+
+  const RNRgb& diff_brdf = power_multiplier / RN_PI;
+  const PhotonRecord *irradiance_photon = NULL;
+  if (settings->irradiance_map) {
+    // use precomputed irradiance of closest photon on a surface facing the same way
+    irradiance_photon = settings->irradiance_map->FindClosestFacing(point, normal, settings->max_estimate_dist_global, irradiance_normal_cosine);
+  }
+  if (irradiance_photon) color += roulette_multiplier * diff_brdf * irradiance_photon->Power();
+  else color += roulette_multiplier * EstimateFlux(settings->photon_map, point, settings->num_photon_estimate, settings->max_estimate_dist_global, diff_brdf, nearby, distances_squared);
+  // add caustic contribution
+  color += roulette_multiplier * EstimateFlux(settings->caustic_map, point, settings->num_photon_estimate, settings->max_estimate_dist_caustic, diff_brdf, nearby, distances_squared);
+  // add emitted light
+  color += brdf->Emission();
+
+  // add direct light contribution with path tracing
+  for (int k = 0; k < scene->NLights(); k++) {
+  R3Light *light = scene->Light(k);
+    if (light->ClassID() == R3PointLight::CLASS_ID()) {
+      R3PointLight *point_light = (R3PointLight *) light;
+      StatsCount(STATS_SHADOW_RAYS);
+      if (!scene->Occluded(point_light->Position(), point)) {
+        const RNRgb& Ic = point_light->Color() / (R3SquaredDistance(point_light->Position(), point));
+        R3Vector L = point_light->DirectionFromPoint(point);
+        RNScalar NL = normal.Dot(L);
+        if (RNIsNegativeOrZero(NL)) {
           continue;
         }
-        normal.Normalize();
-        // add indirect lighting contribution with photon map
-
-        const R3Material *material = (element) ? element->Material() : &R3default_material;
-        const R3Brdf *brdf = (material) ? material->Brdf() : &R3default_brdf;
-
-        //power_multiplier =  brdf->Diffuse();
-        //std::cout<<power_multiplier[0]<< ", " << power_multiplier[1] << ", " << power_multiplier[2] <<std::endl;
-
-        const RNRgb& diff_brdf = power_multiplier / RN_PI;
-        color += roulette_multiplier * EstimateFlux(photon_map, point, num_photon_estimate, max_estimate_dist_proportion_global * scene->BBox().DiagonalRadius(), diff_brdf);
-        // add caustic contribution
-        color += roulette_multiplier * EstimateFlux(caustic_map, point, num_photon_estimate, max_estimate_dist_proportion_caustic * scene->BBox().DiagonalRadius(), diff_brdf);
-        // add emitted light
-        color += brdf->Emission();
-
-        // add direct light contribution with path tracing
-        for (int k = 0; k < scene->NLights(); k++) {
-        R3Light *light = scene->Light(k);
-          if (light->ClassID() == R3PointLight::CLASS_ID()) {
-            R3PointLight *point_light = (R3PointLight *) light;
-            R3SceneElement *intersecting_element = element;
-            if (scene->Intersects(R3Ray(point_light->Position(), point), NULL, &element, NULL, NULL, NULL, NULL) && element == intersecting_element) {              
-              const RNRgb& Ic = point_light->Color() / (R3SquaredDistance(point_light->Position(), point));
-              R3Vector L = point_light->DirectionFromPoint(point);
-              RNScalar NL = normal.Dot(L);
-              if (RNIsNegativeOrZero(NL)) {
-                continue;
-              }
-              color += roulette_multiplier * NL * diff_brdf * Ic;
-            }
-          } else if (light->ClassID() == R3AreaLight::CLASS_ID()) {
-            // monte carlo estimate to evaluate direct illumination
-              // as desdcribed in https://www.cs.utah.edu/~shirley/papers/rw91.pdf
-            R3AreaLight *area_light = (R3AreaLight *) light;
-            R3Point source_pos;
-            RNScalar r1;
-            RNScalar r2;
-            do {
-              r1 = (RNRandomScalar() * 2) - 1;
-              r2 = (RNRandomScalar() * 2) - 1;
-            } while(r1 * r1 + r2 * r2 > 1);
-            source_pos = area_light->Position();
-            source_pos += (r1 * axes1[k] * area_light->Radius()) + (r2 * axes2[k] * area_light->Radius());
-            source_pos += area_light->Direction() * RN_EPSILON;
-            R3SceneElement *intersecting_element = element;
-            R3Vector light_to_point = point - source_pos;
-            light_to_point.Normalize();
-            RNScalar cos_light = light_to_point.Dot(area_light->Direction());
-            RNScalar pdf = RNScalar(1)/ (RN_PI * area_light->Radius() * area_light->Radius());
-            if (RNIsNegativeOrZero(cos_light)) {
-              continue;
-            }
-            if (scene->Intersects(R3Ray(source_pos, point), NULL, &element, NULL, NULL, NULL, NULL) && element == intersecting_element) {              
-              const RNRgb& Ic = area_light->Color() / R3SquaredDistance(source_pos, point);
-              RNScalar cos_point = normal.Dot(-light_to_point);
-              color += roulette_multiplier * diff_brdf * Ic * cos_point * cos_light / pdf;
-            }
-          } else if (light->ClassID() == R3DirectionalLight::CLASS_ID()) {
-            R3DirectionalLight *dir_light = (R3DirectionalLight *) light;
-            R3Vector dir_light_dir = dir_light->Direction();
-            dir_light_dir.Normalize();
-            R3SceneElement *intersecting_element = element;
-            if (scene->Intersects(R3Ray(point - (dir_light_dir * 2 *scene->BBox().DiagonalRadius()), point), NULL, &element, NULL, NULL, NULL, NULL) && element == intersecting_element) {
-              const RNRgb& Ic = dir_light->Color();
-              RNScalar NL = normal.Dot(-dir_light->Direction());
-              if (RNIsNegativeOrZero(NL)) {
-                continue;
-              }
-              color += roulette_multiplier * NL * diff_brdf * Ic;
-            }
-          } else if (light->ClassID() == R3SpotLight::CLASS_ID()) {
-            R3SpotLight *spot_light = (R3SpotLight *) light;
-            R3SceneElement *intersecting_element = element;
-            R3Vector central_direction = spot_light->Direction();
-            central_direction.Normalize();
-            if (normal.Dot(central_direction) < cos(spot_light->CutOffAngle()) && scene->Intersects(R3Ray(spot_light->Position(), point), NULL, &element, NULL, NULL, NULL, NULL) && element == intersecting_element) {              
-              const RNRgb& Ic = spot_light->Color() / (R3SquaredDistance(spot_light->Position(), point));
-              R3Vector L = spot_light->DirectionFromPoint(point);
-              RNScalar NL = normal.Dot(L);
-              if (RNIsNegativeOrZero(NL)) {
-                continue;
-              }
-              color += roulette_multiplier * NL * diff_brdf * Ic;
-            }
-          } else {
-            std::cout<<"unrecognized light"<<std::endl;
-            assert(false);
-          }
+        color += roulette_multiplier * NL * diff_brdf * Ic;
+      }
+    } else if (light->ClassID() == R3AreaLight::CLASS_ID()) {
+      // monte carlo estimate to evaluate direct illumination
+        // as desdcribed in https://www.cs.utah.edu/~shirley/papers/rw91.pdf
+      R3AreaLight *area_light = (R3AreaLight *) light;
+      // uniform point on light disk (two stratified dimensions, no rejection)
+      R3Point source_pos;
+      RNScalar r = sqrt(generator->Scalar());
+      RNScalar phi = RN_TWO_PI * generator->Scalar();
+      RNScalar r1 = r * cos(phi);
+      RNScalar r2 = r * sin(phi);
+      source_pos = area_light->Position();
+      source_pos += (r1 * settings->axes1[k] * area_light->Radius()) + (r2 * settings->axes2[k] * area_light->Radius());
+      source_pos += area_light->Direction() * RN_EPSILON;
+      R3Vector light_to_point = point - source_pos;
+      light_to_point.Normalize();
+      RNScalar cos_light = light_to_point.Dot(area_light->Direction());
+      RNScalar pdf = RNScalar(1)/ (RN_PI * area_light->Radius() * area_light->Radius());
+      if (RNIsNegativeOrZero(cos_light)) {
+        continue;
+      }
+      StatsCount(STATS_SHADOW_RAYS);
+      if (!scene->Occluded(source_pos, point)) {
+        const RNRgb& Ic = area_light->Color() / R3SquaredDistance(source_pos, point);
+        RNScalar cos_point = normal.Dot(-light_to_point);
+        color += roulette_multiplier * diff_brdf * Ic * cos_point * cos_light / pdf;
+      }
+    } else if (light->ClassID() == R3DirectionalLight::CLASS_ID()) {
+      R3DirectionalLight *dir_light = (R3DirectionalLight *) light;
+      R3Vector dir_light_dir = dir_light->Direction();
+      dir_light_dir.Normalize();
+      StatsCount(STATS_SHADOW_RAYS);
+      if (!scene->Occluded(point - (dir_light_dir * 2 *scene->BBox().DiagonalRadius()), point)) {
+        const RNRgb& Ic = dir_light->Color();
+        RNScalar NL = normal.Dot(-dir_light->Direction());
+        if (RNIsNegativeOrZero(NL)) {
+          continue;
         }
+        color += roulette_multiplier * NL * diff_brdf * Ic;
       }
-      color /= num_samples;   
-
-      pixels.push_back(color);
-      num_rendered_pixels++;
+    } else if (light->ClassID() == R3SpotLight::CLASS_ID()) {
+      R3SpotLight *spot_light = (R3SpotLight *) light;
+      R3Vector central_direction = spot_light->Direction();
+      central_direction.Normalize();
+      if (normal.Dot(central_direction) >= cos(spot_light->CutOffAngle())) continue;
+      StatsCount(STATS_SHADOW_RAYS);
+      if (!scene->Occluded(spot_light->Position(), point)) {
+        const RNRgb& Ic = spot_light->Color() / (R3SquaredDistance(spot_light->Position(), point));
+        R3Vector L = spot_light->DirectionFromPoint(point);
+        RNScalar NL = normal.Dot(L);
+        if (RNIsNegativeOrZero(NL)) {
+          continue;
+        }
+        color += roulette_multiplier * NL * diff_brdf * Ic;
+      }
+    } else {
+      std::cout<<"unrecognized light"<<std::endl;
+      assert(false);
     }
-    std::cout<<double(num_rendered_pixels * 100) / total_pixels<<"% of pixels rendered"<<std::endl;
   }
+  return color;
+}
 
-  // Print statistics
-  if (print_verbose) {
-    printf("Rendered image ...\n");
-    printf("  Time = %.2f seconds\n", start_time.Elapsed());
-    printf("  # Rays = %d\n", ray_count);
-    fflush(stdout);
+
+
+static RNRgb
+RenderPixel(RenderSettings *settings, int i, int j, int first_sample, int nsamples, RNRandomGenerator *generator,
+  const PhotonRecord **nearby, RNLength *distances_squared)
+{
+  // Average nsamples samples starting at first_sample
+  RNRgb color = RNRgb(0,0,0);
+  for (int s = first_sample; s < first_sample + nsamples; s ++) {
+    color += RenderSample(settings, i, j, s, generator, nearby, distances_squared);
   }
+  return color / nsamples;
+}
 
-  std::string width_str = std::to_string(width);
-  std::string height_str = std::to_string(height);
-  std::string now = std::to_string(std::chrono::time_point_cast<std::chrono::milliseconds>(
-    std::chrono::system_clock::now()).time_since_epoch().count());
-  std::string grey_conv = std::to_string(double(gray_conv_coeffs[0])) +  "=" + std::to_string(double(gray_conv_coeffs[1])) + "=" + std::to_string(double(gray_conv_coeffs[2]));
-  std::string tone_map = std::to_string(reinhard_tone_map_a);
-  std::ofstream f;
-  f.open(width_str + ":" + height_str + ":"  + grey_conv + ":" + tone_map + ":"  + now + ".csv");
-  f << "pixel number,r,g,b\n";
-  int pix_count = 0;
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      f << std::to_string(double(pixels[pix_count][0])) + "," + std::to_string(pixels[pix_count][1]) + "," + std::to_string(pixels[pix_count][2]) + "\n";
-      pix_count++;
-    }
-  } 
-  std::cout<<"applying tone mapping..."<<std::endl;
-  // apply tone mapping from Reinhard '02
 
-  pix_count = 0;
-  // get avg luminance
-  RNScalar avg_lum = 0.0;
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      RNRgb color = pixels[pix_count];
-      RNScalar curr_lum = gray_conv_coeffs.Dot(R3Vector(color[0], color[1], color[2]));
-      avg_lum += log(RN_EPSILON + curr_lum);
-      pix_count++;
+
+static void
+GetTileRange(RenderSettings *settings, int tile_index, int *imin, int *jmin, int *imax, int *jmax)
+{
+  // Get pixel range of tile
+  int tile_x = tile_index / settings->ntiles_y;
+  int tile_y = tile_index % settings->ntiles_y;
+  *imin = tile_x * render_tile_size;
+  *jmin = tile_y * render_tile_size;
+  *imax = std::min(*imin + render_tile_size, settings->width);
+  *jmax = std::min(*jmin + render_tile_size, settings->height);
+}
+
+
+
+static void
+RenderPilotTile(int tile_index, int thread_index, void *data)
+{
+  RenderSettings *settings = (RenderSettings *) data;
+  int imin, jmin, imax, jmax;
+  GetTileRange(settings, tile_index, &imin, &jmin, &imax, &jmax);
+
+  // Take pilot samples of every pixel, keeping only running mean and variance of their luminance (Welford '62)
+  RNRandomGenerator generator(RNRandomScalarSeed());
+  std::vector<const PhotonRecord *> nearby(settings->num_photon_estimate);
+  std::vector<RNLength> distances_squared(settings->num_photon_estimate);
+  for (int i = imin; i < imax; i++) {
+    for (int j = jmin; j < jmax; j++) {
+      RNScalar mean = 0;
+      RNScalar sum_squared_deviations = 0;
+      for (int s = 0; s < settings->pilot_samples; s++) {
+        RNRgb sample = RenderSample(settings, i, j, s, &generator, nearby.data(), distances_squared.data());
+        RNScalar luminance = 0.2126 * sample.R() + 0.7152 * sample.G() + 0.0722 * sample.B();
+        RNScalar delta = luminance - mean;
+        mean += delta / (s + 1);
+        sum_squared_deviations += delta * (luminance - mean);
+      }
+      settings->pilot_means[i * settings->height + j] = mean;
+      settings->pilot_variances[i * settings->height + j] = sum_squared_deviations / (settings->pilot_samples - 1);
     }
   }
+}
+
+
+
+static long long
+CountSamples(const std::vector<RNScalar>& ratios, RNScalar gain, RNScalar target_error, int min_samples, int max_samples, int *sample_counts)
+{
+  // With n samples pixel k has squared relative error ratios[k] / n, and one more sample lowers it by
+  // ratios[k] / (n (n + 1)).  Give pixel k samples while that is above gain, and its error above target_error
+  // (so n is about sqrt(ratios[k] / gain), which gives the least mean squared relative error for the total).
+  long long total = 0;
+  RNScalar target_squared = target_error * target_error;
+  for (int k = 0; k < (int) ratios.size(); k++) {
+    RNScalar n = std::min(ceil(sqrt(ratios[k] / gain)), ceil(ratios[k] / target_squared));
+    int count = (int) std::max(RNScalar(min_samples), std::min(n, RNScalar(max_samples)));
+    if (sample_counts) sample_counts[k] = count;
+    total += count;
+  }
+  return total;
+}
 
-  avg_lum /= (height*width);
-  avg_lum = exp(avg_lum);
 
-  // get maximum scaled luminance
-  RNScalar max_t_pix = 0.0;
-  pix_count = 0;
+
+static RNScalar
+AllocateSamples(RenderSettings *settings, long long budget)
+{
+  // Filter pilot statistics over neighbouring pixels, so ratios approximate the variance of a pixel by that of
+  // its neighbourhood (pilot samples are left out of the image, so choosing sample counts from them does not bias it)
+  int width = settings->width;
+  int height = settings->height;
+  std::vector<RNScalar> ratios(width * height);
+  std::vector<RNScalar> means(width * height);
+  RNScalar image_mean = 0;
   for (int i = 0; i < width; i++) {
     for (int j = 0; j < height; j++) {
-      RNRgb color = pixels[pix_count];
-      RNScalar curr_lum = gray_conv_coeffs.Dot(R3Vector(color[0], color[1], color[2]));
-      RNScalar t_pix = reinhard_tone_map_a * curr_lum / avg_lum;
-      if (t_pix > max_t_pix) {
-        max_t_pix = t_pix;
+      RNScalar mean = 0;
+      RNScalar variance = 0;
+      int count = 0;
+      for (int di = std::max(i - adaptive_filter_radius, 0); di <= std::min(i + adaptive_filter_radius, width - 1); di++) {
+        for (int dj = std::max(j - adaptive_filter_radius, 0); dj <= std::min(j + adaptive_filter_radius, height - 1); dj++) {
+          mean += settings->pilot_means[di * height + dj];
+          variance += settings->pilot_variances[di * height + dj];
+          count++;
+        }
       }
-      pix_count++;
+      means[i * height + j] = mean / count;
+      ratios[i * height + j] = variance / count;
+      image_mean += mean / count;
     }
   }
+  image_mean /= width * height;
+
+  // Divide variances by squared luminance, so ratios are the samples needed for relative error one
+  RNScalar luminance_floor = adaptive_luminance_floor * image_mean;
+  RNScalar max_ratio = 0;
+  for (int k = 0; k < width * height; k++) {
+    RNScalar luminance = means[k] + luminance_floor;
+    ratios[k] = (RNIsPositive(luminance)) ? ratios[k] / (luminance * luminance) : 0;
+    if (ratios[k] > max_ratio) max_ratio = ratios[k];
+  }
 
-  // apply operator
-  RNScalar global_max_color = 0.0;
-  pix_count = 0;
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      RNRgb color = pixels[pix_count];
-      RNScalar curr_lum = gray_conv_coeffs.Dot(R3Vector(color[0], color[1], color[2]));
-      RNScalar scaling = 1;
-      RNScalar tone_map = 0;
-      if (RNIsPositive(curr_lum)) {
-        RNScalar t_pix = reinhard_tone_map_a * curr_lum / avg_lum;
-        tone_map = t_pix * (1 + (t_pix / pow(max_t_pix, 2))) / (1 + t_pix);
-        scaling = tone_map / curr_lum; 
-      }
-      color *= scaling;
-      // get_max_color
-      RNScalar max_color =  std::max({color[0],color[1], color[2]});      
-      if (max_color > global_max_color) {
-        global_max_color = max_color;
-      }
-      pixels[pix_count] = color;
-      pix_count++;
+  // Find the smallest gain per sample whose samples fit in budget by bisection (on a log scale),
+  // so samples go to the pixels where they lower the relative error most (every pixel gets at least as many
+  // as its pilot, since pilot samples that happen to agree do not show the pixel is smooth)
+  int min_samples = settings->pilot_samples;
+  int max_samples = settings->max_samples - settings->pilot_samples;
+  RNScalar target_error = settings->target_error;
+  RNScalar gain = RN_EPSILON * RN_EPSILON * std::max(max_ratio, RNScalar(1));
+  if (CountSamples(ratios, gain, target_error, min_samples, max_samples, NULL) > budget) {
+    RNScalar low = log(gain);
+    RNScalar high = log(std::max(max_ratio, RN_EPSILON));
+    for (int iteration = 0; iteration < 64; iteration++) {
+      RNScalar middle = 0.5 * (low + high);
+      if (CountSamples(ratios, exp(middle), target_error, min_samples, max_samples, NULL) > budget) low = middle;
+      else high = middle;
     }
+    gain = exp(high);
   }
 
-  // normalize pixel values
-  pix_count = 0;
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      RNRgb color = pixels[pix_count];
-      color /= global_max_color;
-      pixels[pix_count] = color;
-      std::cout<<color[0]<< ", " << color[1] << ", " << color[2] <<std::endl;
+  // Return root mean squared relative error expected from the chosen samples
+  CountSamples(ratios, gain, target_error, min_samples, max_samples, settings->sample_counts);
+  RNScalar mean_squared_error = 0;
+  for (int k = 0; k < width * height; k++) mean_squared_error += ratios[k] / settings->sample_counts[k];
+  return sqrt(mean_squared_error / (width * height));
+}
 
-      image->SetPixelRGB(i, j, color);
-      pix_count++;
+
+
+static void
+RenderTile(int tile_index, int thread_index, void *data)
+{
+  RenderSettings *settings = (RenderSettings *) data;
+  int imin, jmin, imax, jmax;
+  GetTileRange(settings, tile_index, &imin, &jmin, &imax, &jmax);
+
+  // Render pixels into this tile's slice of the framebuffer (after any pilot samples)
+  RNRandomGenerator generator(RNRandomScalarSeed());
+  std::vector<const PhotonRecord *> nearby(settings->num_photon_estimate);
+  std::vector<RNLength> distances_squared(settings->num_photon_estimate);
+  for (int i = imin; i < imax; i++) {
+    for (int j = jmin; j < jmax; j++) {
+      int k = i * settings->height + j;
+      settings->pixels[k] = RenderPixel(settings, i, j, settings->pilot_samples, settings->sample_counts[k], &generator, nearby.data(), distances_squared.data());
     }
   }
-  return image;
+
+  // Print progress
+  int num_rendered_pixels = settings->num_rendered_pixels += (imax - imin) * (jmax - jmin);
+  int total_pixels = settings->width * settings->height;
+  std::lock_guard<std::mutex> lock(settings->print_mutex);
+  std::cout<<double(num_rendered_pixels * 100) / total_pixels<<"% of pixels rendered"<<std::endl;
 }
 
-  
 
 
+int
+RenderImage(R3Scene *scene,
+  PhotonKdtree *photon_map,
+  PhotonKdtree *caustic_map,
+  PhotonKdtree *irradiance_map,
+  int width,
+  int height,
+  int print_verbose,
+  int num_samples,
+  RNScalar target_error,
+  int max_samples,
+  RNScalar max_estimate_dist_proportion_global,
+  RNScalar max_estimate_dist_proportion_caustic,
+  int num_photon_estimate,
+  std::vector<RNRgb>& pixels,
+  std::vector<int>& sample_counts)
 
+{
+  assert(photon_map);
+  assert(caustic_map);
+
+  // Check adaptive sampling has samples for the pilot and as many again for every pixel
+  if ((target_error > 0) && (num_samples < 2 * adaptive_min_pilot_samples)) {
+    fprintf(stderr, "Adaptive sampling (target error %g) needs at least %d samples per pixel\n", target_error, 2 * adaptive_min_pilot_samples);
+    return 0;
+  }
+
+  // Start statistics
+  RNTime start_time;
+  start_time.Read();
+  // framebuffer, pixel (i, j) is at i * height + j
+  pixels.assign(width * height, RNRgb(0, 0, 0));
+  sample_counts.assign(width * height, num_samples);
+
+  RenderSettings settings;
+  settings.scene = scene;
+  settings.photon_map = photon_map;
+  settings.caustic_map = caustic_map;
+  settings.irradiance_map = irradiance_map;
+  settings.width = width;
+  settings.height = height;
+  settings.num_samples = num_samples;
+  settings.target_error = target_error;
+  settings.pilot_samples = (target_error > 0) ? std::max(num_samples / adaptive_pilot_divisor, adaptive_min_pilot_samples) : 0;
+  settings.max_samples = std::max(max_samples, 2 * settings.pilot_samples);
+  settings.sample_stride = (target_error > 0) ? settings.max_samples : num_samples;
+  settings.max_estimate_dist_global = max_estimate_dist_proportion_global * scene->BBox().DiagonalRadius();
+  settings.max_estimate_dist_caustic = max_estimate_dist_proportion_caustic * scene->BBox().DiagonalRadius();
+  settings.num_photon_estimate = num_photon_estimate;
+  settings.roulette_multiplier = RNScalar(1)/ 1 - termination_rate; // becuase of russian roulette
+  settings.ntiles_x = (width + render_tile_size - 1) / render_tile_size;
+  settings.ntiles_y = (height + render_tile_size - 1) / render_tile_size;
+  settings.pixels = pixels.data();
+  settings.sample_counts = sample_counts.data();
+  settings.pilot_means = NULL;
+  settings.pilot_variances = NULL;
+  settings.num_rendered_pixels = 0;
+
+  // precompute axes for area lights
+  settings.axes1.resize(scene->NLights());
+  settings.axes2.resize(scene->NLights());
+  for (int k = 0; k < scene->NLights(); k++) {
+    R3Light *light = scene->Light(k);
+    if (light->ClassID() == R3AreaLight::CLASS_ID()) {
+      R3AreaLight *area_light = (R3AreaLight *) light;
+      getR3CircleAxes(area_light->Direction(), &settings.axes1[k], &settings.axes2[k]);
+    }
+  }
+
+  // Choose samples of every pixel from pilot samples, spending num_samples per pixel on average
+  // (pilot samples included)
+  RNScalar relative_error = 0;
+  std::vector<RNScalar> pilot_means, pilot_variances;
+  if (settings.pilot_samples > 0) {
+    pilot_means.resize(width * height);
+    pilot_variances.resize(width * height);
+    settings.pilot_means = pilot_means.data();
+    settings.pilot_variances = pilot_variances.data();
+    RNParallelFor(settings.ntiles_x * settings.ntiles_y, RenderPilotTile, &settings);
+    long long budget = (long long) (num_samples - settings.pilot_samples) * width * height;
+    relative_error = AllocateSamples(&settings, budget);
+  }
+
+  // Render tiles in parallel
+  RNParallelFor(settings.ntiles_x * settings.ntiles_y, RenderTile, &settings);
+  for (int k = 0; k < width * height; k++) sample_counts[k] += settings.pilot_samples;
+
+  // Print statistics
+  if (print_verbose) {
+    printf("Rendered image ...\n");
+    printf("  Time = %.2f seconds\n", start_time.Elapsed());
+    printf("  # Primary rays = %lld\n", StatsTotal(STATS_PRIMARY_RAYS));
+    long long total_samples = 0;
+    for (int k = 0; k < width * height; k++) total_samples += sample_counts[k];
+    printf("  # Samples per pixel = %.2f\n", (double) total_samples / (width * height));
+    if (settings.pilot_samples > 0) printf("  Relative error = %.4f\n", relative_error);
+    printf("  # Shadow rays = %lld\n", StatsTotal(STATS_SHADOW_RAYS));
+    printf("  # Threads = %d\n", RNNumThreads());
+    fflush(stdout);
+  }
+
+  // Return success
+  return 1;
+}
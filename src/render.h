@@ -4,8 +4,16 @@
 // #define RENDER_H
 
 #include "photonmap.h"
+#include "hdrimage.h"
 
 
 
-R2Image *RenderImage(R3Scene *scene, R3Kdtree<Photon *> *photon_map, R3Kdtree<Photon *> *caustic_map, int width, int height, int print_verbose, int num_samples, RNScalar general_search_range, RNScalar caustic_search_range, RNScalar tone_map_const, int num_photon_estimate);
+// Render linear radiance into framebuffer pixels, pixel (i, j) is at i * height + j.  With a positive
+// target_error, num_samples is the average over the image (at least four): pilot samples, left out of
+// the image, estimate the relative variance around every pixel, and the rest go where they lower the
+// mean squared relative error most (at most max_samples per pixel), stopping early once every pixel
+// reaches target_error.  sample_counts gets the number of samples of every pixel.
+int RenderImage(R3Scene *scene, PhotonKdtree *photon_map, PhotonKdtree *caustic_map, PhotonKdtree *irradiance_map, int width, int height, int print_verbose, int num_samples, RNScalar target_error, int max_samples, RNScalar general_search_range, RNScalar caustic_search_range, int num_photon_estimate, std::vector<RNRgb>& pixels, std::vector<int>& sample_counts);
+
+int RenderImageSPPM(R3Scene *scene, int width, int height, int print_verbose, int num_passes, long photons_per_pass, RNScalar initial_search_range, RNScalar alpha, RNScalar time_budget, int wavefront, std::vector<RNRgb>& pixels);
 
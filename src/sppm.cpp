@@ -0,0 +1,277 @@
+// Source file for stochastic progressive photon mapping (Hachisuka and Jensen '09)
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Include files
+////////////////////////////////////////////////////////////////////////
+
+#include "R3Graphics/R3Graphics.h"
+#include "render.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Progressive render state
+////////////////////////////////////////////////////////////////////////
+
+// program variables
+static RNScalar termination_rate = 0.001;
+static RNScalar camera_index_of_refraction = 1.0;
+
+// statistics of one pixel gathered over all passes so far
+struct SPPMPixel {
+  // progressive radiance estimate
+  RNLength radius_squared;
+  RNScalar photon_count;
+  RNRgb flux;
+  RNRgb emission;
+
+  // visible point of current pass
+  bool is_visible;
+  R3Point position;
+  R3Vector normal;
+  RNRgb diffuse_brdf;
+};
+
+// settings shared by all tasks of a pass
+struct SPPMSettings {
+  R3Scene *scene;
+  int width;
+  int height;
+  int pass;
+  RNScalar alpha;
+  int wavefront;
+  SPPMPixel *pixels;
+  const PhotonKdtree *photon_map;
+};
+
+// number of pixel rows handled by one parallel task
+static const int sppm_rows_per_task = 4;
+
+// random number index of first pixel of first pass (so camera paths don't share random numbers with photons)
+static const unsigned long long sppm_random_stream = 1ULL << 43;
+
+// smallest cosine between normals of a visible point and the photons it gathers
+static const RNScalar sppm_normal_cosine = 0.5;
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Camera pass
+////////////////////////////////////////////////////////////////////////
+
+static void
+SetVisiblePoint(SPPMPixel& pixel, R3SceneElement *element, const R3Point& point, R3Vector normal, const RNRgb& power_multiplier)
+{
+  // remember visible point for photon pass
+  const R3Material *material = (element) ? element->Material() : &R3default_material;
+  const R3Brdf *brdf = (material) ? material->Brdf() : &R3default_brdf;
+  normal.Normalize();
+  pixel.is_visible = true;
+  pixel.position = point;
+  pixel.normal = normal;
+  pixel.diffuse_brdf = power_multiplier / RN_PI;
+  pixel.emission += brdf->Emission();
+}
+
+
+
+static void
+TraceVisiblePointsTask(int task_index, int thread_index, void *data)
+{
+  SPPMSettings *settings = (SPPMSettings *) data;
+  R3Scene *scene = settings->scene;
+  RNRandomGenerator generator(RNRandomScalarSeed());
+  int npixels = settings->width * settings->height;
+  int imin = task_index * sppm_rows_per_task;
+  int imax = std::min(imin + sppm_rows_per_task, settings->width);
+  std::vector<DiffusePath> paths;
+  for (int i = imin; i < imax; i++) {
+    for (int j = 0; j < settings->height; j++) {
+      SPPMPixel& pixel = settings->pixels[i * settings->height + j];
+      pixel.is_visible = false;
+
+      // draw random numbers by pass and pixel so the result does not depend on threads
+      generator.SetIndex(sppm_random_stream + (unsigned long long) settings->pass * npixels + i * settings->height + j);
+
+      // follow jittered camera ray to its first diffuse hit
+      RNScalar jitter_x = generator.Scalar() - 0.5;
+      RNScalar jitter_y = generator.Scalar() - 0.5;
+      R3Ray ray = scene->Viewer().WorldRay(i + jitter_x, j + jitter_y);
+      StatsCount(STATS_PRIMARY_RAYS);
+      if (settings->wavefront) {
+        // queue camera path of every pixel of task, they are traced together below
+        DiffusePath path;
+        path.ray = ray;
+        path.ior = camera_index_of_refraction;
+        path.power_multiplier = RNRgb(1,1,1);
+        path.generator = generator;
+        paths.push_back(path);
+        continue;
+      }
+      RNScalar prev_ior = camera_index_of_refraction;
+      RNRgb power_multiplier = RNRgb(1,1,1);
+      R3SceneElement *element;
+      R3Point point;
+      R3Vector normal;
+      if (!traceRayDiffuse(scene, &prev_ior, ray, &point, &element, &normal, termination_rate, &power_multiplier, &generator)) {
+        continue;
+      }
+      SetVisiblePoint(pixel, element, point, normal, power_multiplier);
+    }
+  }
+
+  // Trace queued camera paths breadth first
+  if (paths.empty()) return;
+  traceRaysDiffuse(scene, paths.data(), (int) paths.size(), termination_rate);
+  for (int k = 0; k < (int) paths.size(); k++) {
+    const DiffusePath& path = paths[k];
+    if (!path.is_diffuse) continue;
+    SPPMPixel& pixel = settings->pixels[imin * settings->height + k];
+    SetVisiblePoint(pixel, path.element, path.point, path.normal, path.power_multiplier);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Photon pass
+////////////////////////////////////////////////////////////////////////
+
+// visitor that sums photons of one pass landing on the surface of a visible point
+struct SPPMGatherer {
+  SPPMGatherer(const R3Vector& normal) : normal(normal), flux(0, 0, 0), count(0) {}
+  void operator()(const PhotonRecord *photon, RNLength distance_squared) {
+    if (normal.Dot(photon->Normal()) < sppm_normal_cosine) return;
+    flux += photon->Power();
+    count++;
+  }
+  R3Vector normal;
+  RNRgb flux;
+  int count;
+};
+
+
+
+static void
+GatherPhotonsTask(int task_index, int thread_index, void *data)
+{
+  SPPMSettings *settings = (SPPMSettings *) data;
+  int imin = task_index * sppm_rows_per_task;
+  int imax = std::min(imin + sppm_rows_per_task, settings->width);
+  for (int i = imin; i < imax; i++) {
+    for (int j = 0; j < settings->height; j++) {
+      SPPMPixel& pixel = settings->pixels[i * settings->height + j];
+      if (!pixel.is_visible) continue;
+
+      // sum photons of this pass that landed on the same surface within radius
+      SPPMGatherer gatherer(pixel.normal);
+      settings->photon_map->ForEachWithin(pixel.position, sqrt(pixel.radius_squared), gatherer);
+      int new_count = gatherer.count;
+      RNRgb new_flux = gatherer.flux;
+      if (new_count == 0) continue;
+
+      // keep only fraction alpha of new photons and shrink radius to match
+      RNScalar count = pixel.photon_count + settings->alpha * new_count;
+      RNScalar ratio = count / (pixel.photon_count + new_count);
+      pixel.radius_squared *= ratio;
+      pixel.flux = (pixel.flux + pixel.diffuse_brdf * new_flux) * ratio;
+      pixel.photon_count = count;
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Function to render image progressively
+////////////////////////////////////////////////////////////////////////
+
+int
+RenderImageSPPM(R3Scene *scene,
+  int width,
+  int height,
+  int print_verbose,
+  int num_passes,
+  long photons_per_pass,
+  RNScalar initial_search_range,
+  RNScalar alpha,
+  RNScalar time_budget,
+  int wavefront,
+  std::vector<RNRgb>& radiance)
+{
+  // Start statistics
+  RNTime start_time;
+  start_time.Read();
+
+  // Initialize pixels with the starting radius
+  RNLength initial_radius = initial_search_range * scene->BBox().DiagonalRadius();
+  std::vector<SPPMPixel> pixels(width * height);
+  for (int i = 0; i < width * height; i++) {
+    pixels[i].radius_squared = initial_radius * initial_radius;
+    pixels[i].photon_count = 0;
+    pixels[i].flux = RNRgb(0, 0, 0);
+    pixels[i].emission = RNRgb(0, 0, 0);
+    pixels[i].is_visible = false;
+  }
+
+  SPPMSettings settings;
+  settings.scene = scene;
+  settings.width = width;
+  settings.height = height;
+  settings.alpha = alpha;
+  settings.wavefront = wavefront;
+  settings.pixels = pixels.data();
+  settings.photon_map = NULL;
+  int ntasks = (width + sppm_rows_per_task - 1) / sppm_rows_per_task;
+
+  // Alternate camera and photon passes, keeping only one pass of photons at a time
+  int pass = 0;
+  while (pass < num_passes) {
+    settings.pass = pass;
+    RNParallelFor(ntasks, TraceVisiblePointsTask, &settings);
+
+    PhotonArena photon_arena;
+    ShootPhotonPass(scene, photons_per_pass, pass, photon_arena);
+    PhotonKdtree photon_map(photon_arena);
+    photon_arena.Empty();
+    settings.photon_map = &photon_map;
+    RNParallelFor(ntasks, GatherPhotonsTask, &settings);
+    settings.photon_map = NULL;
+    pass++;
+
+    // Print progress
+    if (print_verbose) {
+      printf("  Pass %d: %d photons, %.2f seconds\n", pass, photon_map.NPhotons(), start_time.Elapsed());
+      fflush(stdout);
+    }
+
+    // Stop when time is up
+    if ((time_budget > 0) && (start_time.Elapsed() >= time_budget)) break;
+  }
+
+  // Compute radiance of every pixel (each pass carries the power of all lights)
+  radiance.resize(width * height);
+  for (int i = 0; i < width * height; i++) {
+    const SPPMPixel& pixel = pixels[i];
+    radiance[i] = pixel.flux / (pass * RN_PI * pixel.radius_squared);
+    radiance[i] += pixel.emission / pass;
+  }
+
+  // Print statistics
+  if (print_verbose) {
+    printf("Rendered image progressively ...\n");
+    printf("  Time = %.2f seconds\n", start_time.Elapsed());
+    printf("  # Passes = %d\n", pass);
+    printf("  # Photons per pass = %ld\n", photons_per_pass);
+    printf("  # Threads = %d\n", RNNumThreads());
+    fflush(stdout);
+  }
+
+  // Return success
+  return 1;
+}
@@ -0,0 +1,266 @@
+// Source file for render statistics
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Include files
+////////////////////////////////////////////////////////////////////////
+
+#include "R3Graphics/R3Graphics.h"
+#include "stats.h"
+#include <mutex>
+#if (RN_OS != RN_WINDOWS)
+#  include <sys/resource.h>
+#endif
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Counters
+////////////////////////////////////////////////////////////////////////
+
+// names of phases and counters in JSON output
+static const char *stats_phase_names[STATS_NUM_PHASES] = {
+  "read_scene", "emit_photons", "trace_photons", "build_kdtree",
+  "precompute_irradiance", "render", "tone_map", "write_image"
+};
+static const char *stats_counter_names[STATS_NUM_COUNTERS] = {
+  "primary_rays", "shadow_rays", "specular_rays", "photon_rays",
+  "knn_queries", "knn_photons_visited",
+  "photons_emitted", "photons_absorbed", "photons_terminated",
+  "photons_bounce_limited", "photons_escaped"
+};
+
+// counters of exited threads
+static std::mutex stats_mutex;
+static long long stats_totals[STATS_NUM_COUNTERS] = { 0 };
+static long long stats_stored_totals[STATS_MAX_BOUNCES] = { 0 };
+
+// counters of one thread, added to totals when it exits
+struct StatsThreadCounters {
+  StatsThreadCounters(void);
+  ~StatsThreadCounters(void);
+  long long counts[STATS_NUM_COUNTERS];
+  long long stored[STATS_MAX_BOUNCES];
+};
+
+static thread_local StatsThreadCounters stats_thread_counters;
+
+
+
+StatsThreadCounters::
+StatsThreadCounters(void)
+{
+  // Start at zero
+  for (int i = 0; i < STATS_NUM_COUNTERS; i++) counts[i] = 0;
+  for (int i = 0; i < STATS_MAX_BOUNCES; i++) stored[i] = 0;
+}
+
+
+
+StatsThreadCounters::
+~StatsThreadCounters(void)
+{
+  // Add counts to totals
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  for (int i = 0; i < STATS_NUM_COUNTERS; i++) stats_totals[i] += counts[i];
+  for (int i = 0; i < STATS_MAX_BOUNCES; i++) stats_stored_totals[i] += stored[i];
+}
+
+
+
+void
+StatsCount(StatsCounter counter, long long n)
+{
+  // Increment counter of this thread
+  stats_thread_counters.counts[counter] += n;
+}
+
+
+
+void
+StatsCountStoredPhoton(int bounces)
+{
+  // Increment stored photon count of bounce depth
+  if (bounces < 0) bounces = 0;
+  if (bounces >= STATS_MAX_BOUNCES) bounces = STATS_MAX_BOUNCES - 1;
+  stats_thread_counters.stored[bounces]++;
+}
+
+
+
+long long
+StatsTotal(StatsCounter counter)
+{
+  // Return totals of exited threads and count of calling thread
+  std::lock_guard<std::mutex> lock(stats_mutex);
+  return stats_totals[counter] + stats_thread_counters.counts[counter];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Phases
+////////////////////////////////////////////////////////////////////////
+
+// accumulated times and start of running phases
+static RNScalar stats_wall_seconds[STATS_NUM_PHASES] = { 0 };
+static RNScalar stats_cpu_seconds[STATS_NUM_PHASES] = { 0 };
+static RNTime stats_wall_start[STATS_NUM_PHASES];
+static RNScalar stats_cpu_start[STATS_NUM_PHASES] = { 0 };
+
+
+
+static RNScalar
+ProcessCPUSeconds(void)
+{
+  // Return user and system time of all threads of this process
+#if (RN_OS == RN_WINDOWS)
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) return 0;
+  ULARGE_INTEGER kernel, user;
+  kernel.LowPart = kernel_time.dwLowDateTime; kernel.HighPart = kernel_time.dwHighDateTime;
+  user.LowPart = user_time.dwLowDateTime; user.HighPart = user_time.dwHighDateTime;
+  return (kernel.QuadPart + user.QuadPart) * 1.0E-7;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1.0E-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
+
+
+
+static RNScalar
+ProcessPeakMegabytes(void)
+{
+  // Return peak resident set size of this process (0 if unknown)
+#if (RN_OS == RN_LINUX)
+  // ru_maxrss also counts the process that forked us, so read the high water mark of our own memory
+  FILE *fp = fopen("/proc/self/status", "r");
+  if (!fp) return 0;
+  char line[256];
+  long kilobytes = 0;
+  while (fgets(line, sizeof(line), fp)) {
+    if (sscanf(line, "VmHWM: %ld kB", &kilobytes) == 1) break;
+  }
+  fclose(fp);
+  return kilobytes / 1024.0;
+#elif (RN_OS == RN_MAC)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+  return 0;
+#endif
+}
+
+
+
+void
+StatsBeginPhase(StatsPhase phase)
+{
+  // Remember start times
+  stats_wall_start[phase].Read();
+  stats_cpu_start[phase] = ProcessCPUSeconds();
+}
+
+
+
+void
+StatsEndPhase(StatsPhase phase)
+{
+  // Accumulate times since start
+  stats_wall_seconds[phase] += stats_wall_start[phase].Elapsed();
+  stats_cpu_seconds[phase] += ProcessCPUSeconds() - stats_cpu_start[phase];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Output
+////////////////////////////////////////////////////////////////////////
+
+static void
+WriteJSONString(FILE *fp, const char *s)
+{
+  // Write string with quotes, backslashes and control characters escaped
+  fputc('"', fp);
+  for (const char *c = s; *c; c++) {
+    if ((*c == '"') || (*c == '\\')) fprintf(fp, "\\%c", *c);
+    else if ((unsigned char) *c < 0x20) fprintf(fp, "\\u%04x", (unsigned char) *c);
+    else fputc(*c, fp);
+  }
+  fputc('"', fp);
+}
+
+
+
+int
+StatsWriteJSON(const char *filename, const char *scene_name, int width, int height)
+{
+  // Open file
+  FILE *fp = fopen(filename, "w");
+  if (!fp) {
+    fprintf(stderr, "Unable to open stats file %s\n", filename);
+    return 0;
+  }
+
+  // Gather counters
+  long long counts[STATS_NUM_COUNTERS];
+  for (int i = 0; i < STATS_NUM_COUNTERS; i++) counts[i] = StatsTotal((StatsCounter) i);
+  long long stored[STATS_MAX_BOUNCES];
+  long long nstored = 0;
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (int i = 0; i < STATS_MAX_BOUNCES; i++) {
+      stored[i] = stats_stored_totals[i] + stats_thread_counters.stored[i];
+      nstored += stored[i];
+    }
+  }
+
+  // Write run description
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"scene\": ");
+  WriteJSONString(fp, (scene_name) ? scene_name : "");
+  fprintf(fp, ",\n");
+  fprintf(fp, "  \"width\": %d,\n", width);
+  fprintf(fp, "  \"height\": %d,\n", height);
+  fprintf(fp, "  \"threads\": %d,\n", RNNumThreads());
+  fprintf(fp, "  \"peak_rss_mb\": %.3f,\n", ProcessPeakMegabytes());
+
+  // Write phase times
+  fprintf(fp, "  \"phases\": {\n");
+  for (int i = 0; i < STATS_NUM_PHASES; i++) {
+    fprintf(fp, "    \"%s\": { \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f }%s\n", stats_phase_names[i],
+      stats_wall_seconds[i], stats_cpu_seconds[i], (i < STATS_NUM_PHASES - 1) ? "," : "");
+  }
+  fprintf(fp, "  },\n");
+
+  // Write counters
+  fprintf(fp, "  \"counters\": {\n");
+  for (int i = 0; i < STATS_NUM_COUNTERS; i++) {
+    fprintf(fp, "    \"%s\": %lld,\n", stats_counter_names[i], counts[i]);
+  }
+  RNScalar average_visited = (counts[STATS_KNN_QUERIES] > 0) ? (RNScalar) counts[STATS_KNN_PHOTONS_VISITED] / counts[STATS_KNN_QUERIES] : 0;
+  fprintf(fp, "    \"knn_average_photons_visited\": %.3f,\n", average_visited);
+  fprintf(fp, "    \"photons_stored\": %lld\n", nstored);
+  fprintf(fp, "  },\n");
+
+  // Write stored photons per bounce depth
+  fprintf(fp, "  \"photons_stored_per_bounce\": [");
+  for (int i = 0; i < STATS_MAX_BOUNCES; i++) {
+    fprintf(fp, "%s%lld", (i > 0) ? ", " : "", stored[i]);
+  }
+  fprintf(fp, "]\n");
+  fprintf(fp, "}\n");
+
+  // Close file
+  if (fclose(fp) != 0) {
+    fprintf(stderr, "Unable to write stats file %s\n", filename);
+    return 0;
+  }
+
+  // Return success
+  return 1;
+}
@@ -0,0 +1,62 @@
+// Include file for render statistics
+
+#ifndef __STATS__H__
+#define __STATS__H__
+
+
+
+// Phases of a run whose wall and cpu times are accumulated
+
+enum StatsPhase {
+  STATS_READ_SCENE,
+  STATS_EMIT_PHOTONS,
+  STATS_TRACE_PHOTONS,
+  STATS_BUILD_KDTREE,
+  STATS_PRECOMPUTE_IRRADIANCE,
+  STATS_RENDER,
+  STATS_TONE_MAP,
+  STATS_WRITE_IMAGE,
+  STATS_NUM_PHASES
+};
+
+
+
+// Event counters
+
+enum StatsCounter {
+  STATS_PRIMARY_RAYS,
+  STATS_SHADOW_RAYS,
+  STATS_SPECULAR_RAYS,
+  STATS_PHOTON_RAYS,
+  STATS_KNN_QUERIES,
+  STATS_KNN_PHOTONS_VISITED,
+  STATS_PHOTONS_EMITTED,
+  STATS_PHOTONS_ABSORBED,
+  STATS_PHOTONS_TERMINATED,
+  STATS_PHOTONS_BOUNCE_LIMITED,
+  STATS_PHOTONS_ESCAPED,
+  STATS_NUM_COUNTERS
+};
+
+// Stored photons are counted per bounce depth, deeper ones go in the last bin
+#define STATS_MAX_BOUNCES 16
+
+
+
+// Counting is cheap enough for inner loops: every thread increments its own
+// counters, which are added to the totals when the thread exits.  Phases are
+// timed from the main thread.
+
+void StatsCount(StatsCounter counter, long long n = 1);
+void StatsCountStoredPhoton(int bounces);
+long long StatsTotal(StatsCounter counter);
+
+void StatsBeginPhase(StatsPhase phase);
+void StatsEndPhase(StatsPhase phase);
+
+// Write phase times and counters as JSON
+int StatsWriteJSON(const char *filename, const char *scene_name, int width, int height);
+
+
+
+#endif
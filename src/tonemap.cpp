@@ -0,0 +1,100 @@
+// Source file for the tone mapping program
+// Applies the renderer's Reinhard operator to a linear PFM framebuffer
+
+
+
+// Include files
+
+#include "R3Graphics/R3Graphics.h"
+#include "hdrimage.h"
+
+
+
+// Program variables
+
+static char *input_image_name = NULL;
+static char *output_image_name = NULL;
+static RNScalar tone_map_const = 0.3;
+static int print_verbose = 0;
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Program argument parsing
+////////////////////////////////////////////////////////////////////////
+
+static int
+ParseArgs(int argc, char **argv)
+{
+  // Parse arguments
+  argc--; argv++;
+  while (argc > 0) {
+    if ((*argv)[0] == '-') {
+      if (!strcmp(*argv, "-v")) {
+        print_verbose = 1;
+      } else if (!strcmp(*argv, "-tone_map_const")) {
+        argc--; argv++; tone_map_const = atof(*argv);
+      } else {
+        fprintf(stderr, "Invalid program argument: %s", *argv);
+        exit(1);
+      }
+      argv++; argc--;
+    }
+    else {
+      if (!input_image_name) input_image_name = *argv;
+      else if (!output_image_name) output_image_name = *argv;
+      else { fprintf(stderr, "Invalid program argument: %s", *argv); exit(1); }
+      argv++; argc--;
+    }
+  }
+
+  // Check filenames
+  if (!input_image_name || !output_image_name) {
+    fprintf(stderr, "Usage: tonemap input.pfm outputimagefile [-tone_map_const <real>] [-v]\n");
+    return 0;
+  }
+
+  // Return OK status
+  return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Main program
+////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+  // Parse program arguments
+  if (!ParseArgs(argc, argv)) exit(-1);
+
+  // Start statistics
+  RNTime start_time;
+  start_time.Read();
+
+  // Read framebuffer
+  std::vector<RNRgb> pixels;
+  int width, height;
+  if (!ReadPFM(input_image_name, pixels, &width, &height)) exit(-1);
+
+  // Apply tone mapping
+  R2Image *image = ToneMapImage(pixels.data(), width, height, tone_map_const);
+  if (!image) exit(-1);
+
+  // Write image
+  if (!image->Write(output_image_name)) exit(-1);
+  delete image;
+
+  // Print statistics
+  if (print_verbose) {
+    printf("Wrote image to %s ...\n", output_image_name);
+    printf("  Time = %.3f seconds\n", start_time.Elapsed());
+    printf("  Width = %d\n", width);
+    printf("  Height = %d\n", height);
+    fflush(stdout);
+  }
+
+  // Return success
+  return 0;
+}